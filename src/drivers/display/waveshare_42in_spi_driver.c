@@ -5,6 +5,10 @@
 #include "waveshare_42in_spi_driver.h"
 
 #include <esp_attr.h>
+#include <esp_log.h>
+#include <esp_memory_utils.h>
+#include <esp_rom_sys.h>
+#include <freertos/semphr.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -14,6 +18,13 @@
 #define NOT_WAIT_BUSY 0
 #define NOTHING 0x00
 
+#define PSR_OTP_BWR 0x0F  // RES 400x300, REG_EN=0 (OTP LUT), BWR=0 (B/W/R)
+#define PSR_REG_KW 0x3F   // RES 400x300, REG_EN=1 (register LUT), BWR=1 (B/W)
+
+#define DEEP_SLEEP_CHECK_CODE 0xA5
+
+#define TSE_INTERNAL 0x00  // TSE=0 (internal sensor), TO=0 (no offset)
+
 /** Init sequence helpers */
 
 typedef struct {
@@ -27,13 +38,119 @@ typedef struct {
 static const ws42_driver_init_table_entry_t _ws42_driver_init_seq[] =
     {
         {WS42_Driver_CMD_POWER_ON, 0, WAIT_BUSY, {NOTHING}},
-        {WS42_Driver_CMD_PANEL_SETTINGS, 1, NOT_WAIT_BUSY, {0x0F}},
+        {WS42_Driver_CMD_PANEL_SETTINGS, 1, NOT_WAIT_BUSY, {PSR_OTP_BWR}},
+        {WS42_Driver_CMD_TEMP_SENSOR_SEL, 1, NOT_WAIT_BUSY, {TSE_INTERNAL}},
+};
+
+/** Refresh profiles */
+
+#define LUT_VCOM_SIZE 44
+#define LUT_SIZE 42
+
+// Fast B/W waveform, from the Waveshare 4.2" reference code. Meant to be used
+// with the old data RAM filled with white.
+static const uint8_t _ws42_driver_lut_fast_vcom[LUT_VCOM_SIZE] = {
+    0x00, 0x17, 0x00, 0x00, 0x00, 0x02, 0x00, 0x17, 0x17, 0x00, 0x00,
+    0x02, 0x00, 0x0A, 0x01, 0x00, 0x00, 0x01, 0x00, 0x0E, 0x0E, 0x00,
+    0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+static const uint8_t _ws42_driver_lut_fast_white[LUT_SIZE] = {
+    0x40, 0x17, 0x00, 0x00, 0x00, 0x02, 0x90, 0x17, 0x17, 0x00, 0x00,
+    0x02, 0x40, 0x0A, 0x01, 0x00, 0x00, 0x01, 0xA0, 0x0E, 0x0E, 0x00,
+    0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+static const uint8_t _ws42_driver_lut_fast_black[LUT_SIZE] = {
+    0x80, 0x17, 0x00, 0x00, 0x00, 0x02, 0x90, 0x17, 0x17, 0x00, 0x00,
+    0x02, 0x80, 0x0A, 0x01, 0x00, 0x00, 0x01, 0x50, 0x0E, 0x0E, 0x00,
+    0x00, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+// Partial B/W waveform, only pixels whose old and new data differ are
+// driven, the others get a short charge balancing pulse.
+static const uint8_t _ws42_driver_lut_partial_vcom[LUT_VCOM_SIZE] = {
+    0x00, 0x19, 0x01, 0x14, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+};
+static const uint8_t _ws42_driver_lut_partial_ww[LUT_SIZE] = {
+    0x18, 0x19, 0x01, 0x14, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+};
+static const uint8_t _ws42_driver_lut_partial_kw[LUT_SIZE] = {
+    0x5A, 0x19, 0x01, 0x14, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+};
+static const uint8_t _ws42_driver_lut_partial_wk[LUT_SIZE] = {
+    0xA5, 0x19, 0x01, 0x14, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+};
+static const uint8_t _ws42_driver_lut_partial_kk[LUT_SIZE] = {
+    0x24, 0x19, 0x01, 0x14, 0x01, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+};
+
+typedef struct {
+  uint8_t panel_settings;
+
+  // Sent to WS42_Driver_CMD_LUT_VCOM .. WS42_Driver_CMD_LUT_BB, unused with
+  // the OTP LUT.
+  const uint8_t* luts[5];
+} ws42_driver_profile_t;
+
+static const ws42_driver_profile_t _ws42_driver_profiles[] = {
+    [WS42_DRIVER_PROFILE_FULL] = {PSR_OTP_BWR, {NULL}},
+    [WS42_DRIVER_PROFILE_FAST_BW] = {PSR_REG_KW,
+                                     {_ws42_driver_lut_fast_vcom,
+                                      _ws42_driver_lut_fast_white,
+                                      _ws42_driver_lut_fast_white,
+                                      _ws42_driver_lut_fast_black,
+                                      _ws42_driver_lut_fast_black}},
+    [WS42_DRIVER_PROFILE_PARTIAL] = {PSR_REG_KW,
+                                     {_ws42_driver_lut_partial_vcom,
+                                      _ws42_driver_lut_partial_ww,
+                                      _ws42_driver_lut_partial_kw,
+                                      _ws42_driver_lut_partial_wk,
+                                      _ws42_driver_lut_partial_kk}},
+};
+
+// Refresh durations measured at 25 C with each profile.
+static const uint32_t _ws42_driver_profile_refresh_ms[] = {
+    [WS42_DRIVER_PROFILE_FULL] = 15000,
+    [WS42_DRIVER_PROFILE_FAST_BW] = 4000,
+    [WS42_DRIVER_PROFILE_PARTIAL] = 800,
 };
 
 /** Private variables */
 
+static const char TAG[] = "ws42_driver";
 static ws42_driver_config_t driver_config;
 static spi_device_handle_t screen_spi_handler;
+static SemaphoreHandle_t busy_released = NULL;
+static int64_t last_command_at_us = 0;
+static ws42_driver_refresh_profile_e refresh_profile = WS42_DRIVER_PROFILE_FULL;
+
+static int8_t temperature = WS42_DRIVER_DEFAULT_CELSIUS;
+static int64_t temperature_read_at_us = 0;
+static uint8_t temperature_valid = 0;
+
+// Measured over predicted refresh duration, in percent, for each profile.
+static uint16_t refresh_scale_percent[] = {100, 100, 100};
+static int64_t refresh_started_at_us = 0;
+static uint32_t refresh_predicted_ms = 0;
+
+static ws42_driver_power_state_e power_state = WS42_DRIVER_POWER_ON;
+static ws42_driver_power_policy_e power_policy = WS42_DRIVER_POWER_POLICY_ALWAYS_ON;
+static uint32_t update_interval_ms = 0;
+static uint32_t ram_epoch = 0;
+
+// Time to get back to WS42_DRIVER_POWER_ON from each state, measured on every
+// wake up, seeded with typical values.
+static uint32_t wake_latency_ms[] = {
+    [WS42_DRIVER_POWER_ON] = 0,
+    [WS42_DRIVER_POWER_OFF] = 100,
+    [WS42_DRIVER_POWER_DEEP_SLEEP] = 700,
+};
+
+// Ping-pong buffers, one is packed while the DMA sends the other.
+DMA_ATTR static uint8_t _ws42_driver_chunks[2][WS42_DRIVER_CHUNK_SIZE];
+static spi_transaction_t _ws42_driver_transactions[2];
 
 /** Private function declarations */
 
@@ -43,7 +160,7 @@ static spi_bus_config_t ws42_driver_get_spi_bus_config(void) {
                              .sclk_io_num = driver_config.spi_clk_pin,
                              .quadwp_io_num = -1,
                              .quadhd_io_num = -1,
-                             .max_transfer_sz = 16384};
+                             .max_transfer_sz = WS42_DRIVER_MAX_TRANSFER_SIZE};
   return buscfg;
 }
 
@@ -53,12 +170,24 @@ __handle_data_command_pre_transmision(spi_transaction_t* trans) {
   gpio_set_level(driver_config.gpio_dc_pin, dc);
 }
 
+/**
+ * BUSY is low while the controller works, the rising edge means it is ready.
+ */
+static void IRAM_ATTR __handle_busy_released(void* arg) {
+  BaseType_t higher_priority_task_woken = pdFALSE;
+  xSemaphoreGiveFromISR(busy_released, &higher_priority_task_woken);
+  portYIELD_FROM_ISR(higher_priority_task_woken);
+}
+
 static spi_device_interface_config_t ws42_driver_get_spi_device_config(void) {
   spi_device_interface_config_t devcfg = {
       .clock_speed_hz = SPI_MASTER_FREQ_26M,
       .mode = 0,
       .spics_io_num = driver_config.spi_cs_pin,
       .queue_size = 12,
+      // The module has a single bidirectional data line, replies come back
+      // on MOSI.
+      .flags = SPI_DEVICE_3WIRE | SPI_DEVICE_HALFDUPLEX,
       .pre_cb = __handle_data_command_pre_transmision,
   };
   return devcfg;
@@ -73,7 +202,7 @@ static void _ws42_driver_init_gpio(void) {
   pin.intr_type = GPIO_INTR_DISABLE, pin.mode = GPIO_MODE_OUTPUT,
   pin.pin_bit_mask = _BIT(driver_config.gpio_dc_pin), gpio_config(&pin);
 
-  pin.intr_type = GPIO_INTR_DISABLE;
+  pin.intr_type = GPIO_INTR_POSEDGE;
   pin.mode = GPIO_MODE_INPUT;
   pin.pull_down_en = DISABLE;
   pin.pull_up_en = DISABLE;
@@ -81,17 +210,27 @@ static void _ws42_driver_init_gpio(void) {
 
   gpio_set_level(driver_config.gpio_rst_pin, 1);
   gpio_set_level(driver_config.gpio_dc_pin, 0);
+
+  if (busy_released == NULL) {
+    busy_released = xSemaphoreCreateBinary();
+    assert(busy_released != NULL);
+  }
+
+  // Other drivers may have installed the shared ISR service already.
+  const esp_err_t error = gpio_install_isr_service(0);
+  if (error != ESP_ERR_INVALID_STATE) {
+    ESP_ERROR_CHECK(error);
+  }
+  ESP_ERROR_CHECK(gpio_isr_handler_add(driver_config.gpio_busy_pin,
+                                       __handle_busy_released, NULL));
 }
 
 static void _ws42_driver_exec_init_table(void) {
   for (uint8_t tb_idx = 0; tb_idx < ARRAY_SIZE(_ws42_driver_init_seq); tb_idx++) {
     const ws42_driver_init_table_entry_t entry = _ws42_driver_init_seq[tb_idx];
 
-    ws42_driver_send_command((ws42_driver_cmd_e)entry.cmd);
-
-    for (uint8_t data_idx = 0; data_idx < entry.data_len; data_idx++) {
-      ws42_driver_send_data(entry.data[data_idx]);
-    }
+    ws42_driver_send_command_data((ws42_driver_cmd_e)entry.cmd, entry.data,
+                                  entry.data_len);
 
     if (entry.wait_busy) {
       ws42_driver_wait_busy_ack();
@@ -101,21 +240,177 @@ static void _ws42_driver_exec_init_table(void) {
   ws42_driver_wait_busy_ack();
 }
 
-static void _ws42_driver_spi_send_byte(const uint8_t data, const uint8_t data_command,
-                                       bool keep_cs_active) {
+static void _ws42_driver_spi_send_byte(const uint8_t data, const uint8_t data_command) {
   esp_err_t error;
   spi_transaction_t t;
   memset(&t, 0, sizeof(t));
 
   t.length = BYTE_BITS;
-  t.tx_buffer = &data;
+  t.tx_data[0] = data;
   t.user = (void*)data_command;
+  t.flags = SPI_TRANS_USE_TXDATA;
+
+  error = spi_device_polling_transmit(screen_spi_handler, &t);
+  assert(error == ESP_OK);
+  if (!data_command) {
+    last_command_at_us = esp_timer_get_time();
+  }
+}
+
+/**
+ * Queues `data_length` bytes, up to 4 are copied inline into the transaction.
+ * With `keep_cs_active` CS stays low after it, the bus must be acquired.
+ */
+static void _ws42_driver_queue(spi_transaction_t* t, const uint8_t* data,
+                               uint32_t data_length, const uint8_t data_command,
+                               bool keep_cs_active) {
+  memset(t, 0, sizeof(*t));
+
+  t->length = BYTE_BITS * data_length;
+  t->user = (void*)data_command;
+  if (data_length <= sizeof(t->tx_data)) {
+    t->flags = SPI_TRANS_USE_TXDATA;
+    memcpy(t->tx_data, data, data_length);
+  } else {
+    t->tx_buffer = data;
+  }
   if (keep_cs_active) {
-    t.flags = SPI_TRANS_CS_KEEP_ACTIVE;
+    t->flags |= SPI_TRANS_CS_KEEP_ACTIVE;
   }
+  ESP_ERROR_CHECK(spi_device_queue_trans(screen_spi_handler, t, portMAX_DELAY));
+}
+
+static void _ws42_driver_queue_data(uint8_t slot, const uint8_t* data,
+                                    uint32_t data_length, bool keep_cs_active) {
+  _ws42_driver_queue(&_ws42_driver_transactions[slot], data, data_length, 1,
+                     keep_cs_active);
+}
 
+static void _ws42_driver_wait_queued_data(void) {
+  spi_transaction_t* done;
+  ESP_ERROR_CHECK(
+      spi_device_get_trans_result(screen_spi_handler, &done, portMAX_DELAY));
+}
+
+static void _ws42_driver_copy_chunk(uint8_t* chunk, uint32_t offset,
+                                    uint32_t length, void* arg) {
+  memcpy(chunk, &((const uint8_t*)arg)[offset], length);
+}
+
+/**
+ * Sends the chunks packed by `fill`, with `hold_cs` CS stays low until the
+ * last one so they continue a command (See `ws42_driver_send_command_data`).
+ */
+static void _ws42_driver_send_stream(ws42_driver_fill_cb_t fill, void* arg,
+                                     uint32_t data_length, bool hold_cs) {
+  uint8_t in_flight = 0;
+  uint8_t slot = 0;
+  for (uint32_t offset = 0; offset < data_length;) {
+    const uint32_t remaining = data_length - offset;
+    const uint32_t length =
+        remaining < WS42_DRIVER_CHUNK_SIZE ? remaining : WS42_DRIVER_CHUNK_SIZE;
+
+    // Transactions finish in order, so waiting for the oldest one frees the
+    // buffer about to be packed.
+    if (in_flight == 2) {
+      _ws42_driver_wait_queued_data();
+      in_flight--;
+    }
+
+    fill(_ws42_driver_chunks[slot], offset, length, arg);
+    _ws42_driver_queue_data(slot, _ws42_driver_chunks[slot], length,
+                            hold_cs && (offset + length) < data_length);
+    in_flight++;
+    offset += length;
+    slot ^= 1;
+  }
+
+  while (in_flight--) {
+    _ws42_driver_wait_queued_data();
+  }
+}
+
+static void _ws42_driver_send_buffer(const uint8_t* data, uint32_t data_length,
+                                     bool hold_cs) {
+  // The SPI driver would malloc a copy of buffers the DMA can't read, go
+  // through the ping-pong buffers instead.
+  if (!esp_ptr_dma_capable(data) || ((uintptr_t)data % 4) ||
+      (data_length % 4)) {
+    _ws42_driver_send_stream(_ws42_driver_copy_chunk, (void*)data, data_length,
+                             hold_cs);
+    return;
+  }
+
+  uint8_t in_flight = 0;
+  uint8_t slot = 0;
+  for (uint32_t offset = 0; offset < data_length;) {
+    const uint32_t remaining = data_length - offset;
+    const uint32_t length = remaining < WS42_DRIVER_MAX_TRANSFER_SIZE
+                                ? remaining
+                                : WS42_DRIVER_MAX_TRANSFER_SIZE;
+    if (in_flight == 2) {
+      _ws42_driver_wait_queued_data();
+      in_flight--;
+    }
+
+    _ws42_driver_queue_data(slot, &data[offset], length,
+                            hold_cs && (offset + length) < data_length);
+    in_flight++;
+    offset += length;
+    slot ^= 1;
+  }
+
+  while (in_flight--) {
+    _ws42_driver_wait_queued_data();
+  }
+}
+
+static uint8_t _ws42_driver_spi_read_bytes(uint8_t* data, uint8_t data_length) {
+  esp_err_t error;
+  spi_transaction_t t;
+  memset(&t, 0, sizeof(t));
+
+  t.rxlength = BYTE_BITS * data_length;
+  t.flags = SPI_TRANS_USE_RXDATA;
+  t.user = (void*)1;
   error = spi_device_polling_transmit(screen_spi_handler, &t);
-  assert(error == ESP_OK);
+  if (error != ESP_OK) {
+    return ESP_FAIL;
+  }
+
+  memcpy(data, t.rx_data, data_length);
+  return ESP_OK;
+}
+
+/**
+ * Refreshes get slower as the panel gets colder, the OTP picks longer
+ * waveforms and the particles move slower.
+ */
+static uint32_t _ws42_driver_temperature_scale_percent(int8_t celsius) {
+  if (celsius < 5) {
+    return 250;
+  } else if (celsius < 15) {
+    return 160;
+  } else if (celsius < 30) {
+    return 100;
+  }
+  return 85;
+}
+
+/**
+ * Deepest state whose wake up cost is small next to the time the panel will
+ * stay unused.
+ */
+static ws42_driver_power_state_e _ws42_driver_auto_power_state(void) {
+  const uint32_t factor = WS42_DRIVER_SLEEP_PAYOFF_FACTOR;
+  if (update_interval_ms >=
+      wake_latency_ms[WS42_DRIVER_POWER_DEEP_SLEEP] * factor) {
+    return WS42_DRIVER_POWER_DEEP_SLEEP;
+  } else if (update_interval_ms >=
+             wake_latency_ms[WS42_DRIVER_POWER_OFF] * factor) {
+    return WS42_DRIVER_POWER_OFF;
+  }
+  return WS42_DRIVER_POWER_ON;
 }
 
 static void _ws42_driver_init_spi_device(void) {
@@ -142,6 +437,8 @@ uint8_t ws42_driver_init(const ws42_driver_config_t config) {
   ws42_driver_hard_reset();
   sleep_ms(1000);
   _ws42_driver_exec_init_table();
+  refresh_profile = WS42_DRIVER_PROFILE_FULL;
+  power_state = WS42_DRIVER_POWER_ON;
 
   return ESP_OK;
 }
@@ -156,30 +453,297 @@ void ws42_driver_hard_reset(void) {
   ws42_driver_wait_busy_ack();
 }
 
+uint8_t ws42_driver_wait_busy(uint32_t timeout_ms) {
+  // The controller takes a moment to pull BUSY low after a command, checking
+  // the level right away could see the idle state from before it.
+  const int64_t elapsed_us = esp_timer_get_time() - last_command_at_us;
+  if (elapsed_us < WS42_DRIVER_BUSY_GUARD_US) {
+    esp_rom_delay_us(WS42_DRIVER_BUSY_GUARD_US - elapsed_us);
+  }
+
+  // Drops an edge left over from a previous wait, then checks the level so a
+  // release that happened before this call is not waited for.
+  xSemaphoreTake(busy_released, 0);
+  if (gpio_get_level(driver_config.gpio_busy_pin)) {
+    return 1;
+  }
+
+  if (xSemaphoreTake(busy_released, pdMS_TO_TICKS(timeout_ms)) == pdTRUE) {
+    return 1;
+  }
+
+  return gpio_get_level(driver_config.gpio_busy_pin) ? 1 : 0;
+}
+
 void ws42_driver_wait_busy_ack() {
-  do {
-    ws42_driver_send_command(WS42_Driver_CMD_GET_BUSY);
-    sleep_ms(20);
-  } while (!(gpio_get_level(driver_config.gpio_busy_pin)));
-  sleep_ms(20);
+  if (!ws42_driver_wait_busy(WS42_DRIVER_BUSY_TIMEOUT_MS)) {
+    ESP_LOGW(TAG, "Display still busy after %d ms", WS42_DRIVER_BUSY_TIMEOUT_MS);
+  }
 }
 
 void ws42_driver_send_command(ws42_driver_cmd_e cmd) {
-  _ws42_driver_spi_send_byte((const uint8_t)cmd, 0, false);
+  _ws42_driver_spi_send_byte((const uint8_t)cmd, 0);
 }
 
 void ws42_driver_send_data(uint8_t data) {
-  _ws42_driver_spi_send_byte(data, 1, false);
+  _ws42_driver_spi_send_byte(data, 1);
 }
 
-void ws42_driver_send_data_buffer(uint8_t* data, uint16_t data_length) {
-  esp_err_t error;
-  spi_transaction_t t;
+void ws42_driver_send_command_data(ws42_driver_cmd_e cmd, const uint8_t* data,
+                                   uint32_t data_length) {
+  ESP_ERROR_CHECK(spi_device_acquire_bus(screen_spi_handler, portMAX_DELAY));
+
+  // The whole sequence is queued, polling and queued transactions can't be
+  // mixed while CS is held. CS stays low from the command through its
+  // parameters.
+  const uint8_t cmd_byte = (const uint8_t)cmd;
+  _ws42_driver_queue(&_ws42_driver_transactions[0], &cmd_byte, 1, 0,
+                     data_length > 0);
+  _ws42_driver_wait_queued_data();
+  last_command_at_us = esp_timer_get_time();
+
+  if (data_length > sizeof(((spi_transaction_t*)NULL)->tx_data)) {
+    _ws42_driver_send_buffer(data, data_length, true);
+  } else if (data_length) {
+    _ws42_driver_queue_data(0, data, data_length, false);
+    _ws42_driver_wait_queued_data();
+  }
 
-  memset(&t, 0, sizeof(t));
-  t.length = BYTE_BITS * data_length;
-  t.tx_buffer = data;
-  t.user = (void*)1;
-  error = spi_device_polling_transmit(screen_spi_handler, &t);
-  assert(error == ESP_OK);
+  spi_device_release_bus(screen_spi_handler);
+}
+
+void ws42_driver_send_data_buffer(const uint8_t* data, uint32_t data_length) {
+  _ws42_driver_send_buffer(data, data_length, false);
+}
+
+void ws42_driver_send_data_stream(ws42_driver_fill_cb_t fill, void* arg,
+                                  uint32_t data_length) {
+  _ws42_driver_send_stream(fill, arg, data_length, false);
+}
+
+void ws42_driver_partial_enter(void) {
+  ws42_driver_send_command(WS42_Driver_CMD_PARTIAL_IN);
+}
+
+void ws42_driver_partial_exit(void) {
+  ws42_driver_send_command(WS42_Driver_CMD_PARTIAL_OUT);
+}
+
+void ws42_driver_set_partial_window(uint16_t x, uint16_t y, uint16_t width,
+                                    uint16_t height) {
+  const uint16_t x_start = x & ~0x07;
+  const uint16_t x_end = (x + width - 1) | 0x07;
+  const uint16_t y_end = y + height - 1;
+  const uint8_t params[] = {
+      (x_start >> 8) & 0x01,  // HRST[8:3]
+      x_start & 0xF8,
+      (x_end >> 8) & 0x01,  // HRED[8:3]
+      x_end & 0xFF,
+      (y >> 8) & 0x01,  // VRST[8:0]
+      y & 0xFF,
+      (y_end >> 8) & 0x01,  // VRED[8:0]
+      y_end & 0xFF,
+      0x01,  // PT_SCAN, gates scan inside and outside
+  };
+
+  ws42_driver_send_command_data(WS42_Driver_CMD_PARTIAL_WINDOW, params,
+                                sizeof(params));
+}
+
+void ws42_driver_set_refresh_profile(ws42_driver_refresh_profile_e profile) {
+  if (profile == refresh_profile) {
+    return;
+  }
+
+  const ws42_driver_profile_t* settings = &_ws42_driver_profiles[profile];
+  ws42_driver_send_command_data(WS42_Driver_CMD_PANEL_SETTINGS,
+                                &settings->panel_settings, 1);
+
+  if (settings->luts[0]) {
+    ws42_driver_send_command_data(WS42_Driver_CMD_LUT_VCOM, settings->luts[0],
+                                  LUT_VCOM_SIZE);
+    for (uint8_t idx = 1; idx < ARRAY_SIZE(settings->luts); idx++) {
+      ws42_driver_send_command_data(
+          (ws42_driver_cmd_e)(WS42_Driver_CMD_LUT_VCOM + idx),
+          settings->luts[idx], LUT_SIZE);
+    }
+  }
+
+  refresh_profile = profile;
+}
+
+ws42_driver_refresh_profile_e ws42_driver_get_refresh_profile(void) {
+  return refresh_profile;
+}
+
+uint8_t ws42_driver_read_temperature(int8_t* celsius) {
+  uint8_t data[2];
+
+  // The internal sensor is selected by the init table. Nothing may go out
+  // between the command and the read, the reply belongs to the last command
+  // sent. The wait only watches the BUSY pin.
+  ws42_driver_send_command(WS42_Driver_CMD_TEMP_SENSOR_CAL);
+  if (!ws42_driver_wait_busy(100)) {
+    return ESP_FAIL;
+  }
+
+  if (_ws42_driver_spi_read_bytes(data, sizeof(data)) != ESP_OK) {
+    return ESP_FAIL;
+  }
+
+  // TS[8:1] is the temperature in C, only TS[0] (half degree) is left in the
+  // second byte. Anything else means nothing is driving the line: stuck high
+  // fails that check, stuck low reads all zeros.
+  if ((data[1] & 0x7F) || !(data[0] | data[1])) {
+    return ESP_FAIL;
+  }
+
+  *celsius = (int8_t)data[0];
+  return ESP_OK;
+}
+
+int8_t ws42_driver_get_temperature(void) {
+  const int64_t now = esp_timer_get_time();
+  if (power_state != WS42_DRIVER_POWER_ON) {
+    return temperature;  // Not worth a wake up, use the last reading
+  }
+
+  if (temperature_read_at_us &&
+      (now - temperature_read_at_us) <
+          (int64_t)WS42_DRIVER_TEMPERATURE_MAX_AGE_MS * 1000) {
+    return temperature;
+  }
+
+  int8_t celsius;
+  temperature_read_at_us = now;
+  if (ws42_driver_read_temperature(&celsius) == ESP_OK) {
+    temperature = celsius;
+    temperature_valid = 1;
+    ESP_LOGI(TAG, "Panel temperature %d C", celsius);
+  } else if (!temperature_valid) {
+    ESP_LOGW(TAG, "Temperature sensor not readable, assuming %d C",
+             WS42_DRIVER_DEFAULT_CELSIUS);
+  }
+  return temperature;
+}
+
+uint8_t ws42_driver_profile_allowed(ws42_driver_refresh_profile_e profile,
+                                    int8_t celsius) {
+  if (profile == WS42_DRIVER_PROFILE_FULL) {
+    return 1;  // The OTP waveforms cover the whole operating range
+  }
+  return celsius >= WS42_DRIVER_FAST_MIN_CELSIUS &&
+         celsius <= WS42_DRIVER_FAST_MAX_CELSIUS;
+}
+
+uint32_t ws42_driver_predict_refresh_ms(ws42_driver_refresh_profile_e profile,
+                                        int8_t celsius) {
+  return (_ws42_driver_profile_refresh_ms[profile] *
+          _ws42_driver_temperature_scale_percent(celsius) / 100) *
+         refresh_scale_percent[profile] / 100;
+}
+
+void ws42_driver_refresh(void) {
+  refresh_predicted_ms =
+      ws42_driver_predict_refresh_ms(refresh_profile, temperature);
+  ws42_driver_send_command(WS42_Driver_CMD_DISPLAY_REFRESH);
+  refresh_started_at_us = esp_timer_get_time();
+}
+
+uint8_t ws42_driver_wait_refresh(void) {
+  // Generous margin, the prediction only guards against a stuck panel.
+  const uint32_t timeout_ms = (refresh_predicted_ms * 2) + 1000;
+  if (!ws42_driver_wait_busy(timeout_ms)) {
+    ESP_LOGW(TAG, "Refresh still running after %u ms", (unsigned)timeout_ms);
+    return 0;
+  }
+
+  const uint32_t measured_ms =
+      (esp_timer_get_time() - refresh_started_at_us) / 1000;
+  const uint32_t unscaled_ms =
+      (_ws42_driver_profile_refresh_ms[refresh_profile] *
+       _ws42_driver_temperature_scale_percent(temperature) / 100);
+
+  // Moving average, so one odd refresh doesn't throw the predictions off.
+  if (unscaled_ms) {
+    const uint32_t scale = (measured_ms * 100) / unscaled_ms;
+    refresh_scale_percent[refresh_profile] =
+        ((refresh_scale_percent[refresh_profile] * 3) + scale) / 4;
+  }
+  ESP_LOGI(TAG, "Refresh took %u ms (predicted %u ms)", (unsigned)measured_ms,
+           (unsigned)refresh_predicted_ms);
+  return 1;
+}
+
+void ws42_driver_set_power_policy(ws42_driver_power_policy_e policy,
+                                  uint32_t interval_ms) {
+  power_policy = policy;
+  update_interval_ms = interval_ms;
+}
+
+ws42_driver_power_state_e ws42_driver_get_power_state(void) {
+  return power_state;
+}
+
+uint32_t ws42_driver_get_ram_epoch(void) {
+  return ram_epoch;
+}
+
+void ws42_driver_power_down(void) {
+  ws42_driver_power_state_e target = WS42_DRIVER_POWER_ON;
+  switch (power_policy) {
+    case WS42_DRIVER_POWER_POLICY_ALWAYS_ON:
+      return;
+    case WS42_DRIVER_POWER_POLICY_POWER_OFF:
+      target = WS42_DRIVER_POWER_OFF;
+      break;
+    case WS42_DRIVER_POWER_POLICY_DEEP_SLEEP:
+      target = WS42_DRIVER_POWER_DEEP_SLEEP;
+      break;
+    case WS42_DRIVER_POWER_POLICY_AUTO:
+      target = _ws42_driver_auto_power_state();
+      break;
+  }
+
+  if (target <= power_state) {
+    return;
+  }
+
+  if (power_state == WS42_DRIVER_POWER_ON) {
+    ws42_driver_send_command(WS42_Driver_CMD_POWER_OFF);
+    ws42_driver_wait_busy_ack();
+  }
+
+  if (target == WS42_DRIVER_POWER_DEEP_SLEEP) {
+    const uint8_t check_code = DEEP_SLEEP_CHECK_CODE;
+    ws42_driver_send_command_data(WS42_Driver_CMD_DEEP_SLEEP, &check_code, 1);
+    ram_epoch++;  // The display RAM and settings are lost
+  }
+
+  power_state = target;
+}
+
+void ws42_driver_wake(void) {
+  if (power_state == WS42_DRIVER_POWER_ON) {
+    return;
+  }
+
+  const int64_t started_at = esp_timer_get_time();
+  if (power_state == WS42_DRIVER_POWER_DEEP_SLEEP) {
+    // Only a reset leaves deep sleep, the init table powers the panel on.
+    ws42_driver_hard_reset();
+    _ws42_driver_exec_init_table();
+    refresh_profile = WS42_DRIVER_PROFILE_FULL;
+  } else {
+    ws42_driver_send_command(WS42_Driver_CMD_POWER_ON);
+    ws42_driver_wait_busy_ack();
+  }
+
+  wake_latency_ms[power_state] = (esp_timer_get_time() - started_at) / 1000;
+  ESP_LOGI(TAG, "Woke up from power state %d in %u ms", power_state,
+           (unsigned)wake_latency_ms[power_state]);
+  power_state = WS42_DRIVER_POWER_ON;
+
+  // Readings are skipped while asleep, catch up now if the cache is stale.
+  ws42_driver_get_temperature();
 }
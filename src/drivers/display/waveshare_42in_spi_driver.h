@@ -17,7 +17,7 @@
  *   .height = 300,
  *
  *   // Define the GPIO pins used for SPI communication and control signals
- *   .spi_miso_pin = GPIO_NUM_25,
+ *   .spi_miso_pin = GPIO_NUM_NC,
  *   .spi_mosi_pin = GPIO_NUM_23,
  *   .spi_clk_pin = GPIO_NUM_19,
  *   .spi_cs_pin = GPIO_NUM_22,
@@ -38,6 +38,60 @@
 #include <driver/spi_master.h>
 #include "utils/defs.h"
 
+/**
+ * @brief Longest time `ws42_driver_wait_busy_ack` waits for the display, a full tri-color refresh takes ~15 s.
+ */
+#define WS42_DRIVER_BUSY_TIMEOUT_MS 30000
+
+/**
+ * @brief Time the controller gets to pull BUSY low after a command, `ws42_driver_wait_busy` doesn't look at the
+ * pin before it has passed.
+ */
+#define WS42_DRIVER_BUSY_GUARD_US 1000
+
+/**
+ * @brief Panel temperature readings are reused for this long before the sensor is read again.
+ */
+#define WS42_DRIVER_TEMPERATURE_MAX_AGE_MS (10 * 60 * 1000)
+
+/**
+ * @brief Temperature assumed while the sensor can't be read.
+ */
+#define WS42_DRIVER_DEFAULT_CELSIUS 25
+
+/**
+ * @brief Temperature range, in C, the register LUT waveforms are tuned for. Outside of it only the OTP waveform
+ * (See `WS42_DRIVER_PROFILE_FULL`) is used, as it compensates for temperature.
+ */
+#define WS42_DRIVER_FAST_MIN_CELSIUS 10
+#define WS42_DRIVER_FAST_MAX_CELSIUS 40
+
+/**
+ * @brief With `WS42_DRIVER_POWER_POLICY_AUTO`, a power state is used only when the time between updates is at
+ * least this many times its measured wake up latency.
+ */
+#define WS42_DRIVER_SLEEP_PAYOFF_FACTOR 10
+
+/**
+ * @brief Largest single SPI DMA transfer, also used as the bus `max_transfer_sz`.
+ */
+#define WS42_DRIVER_MAX_TRANSFER_SIZE 16384
+
+/**
+ * @brief Size of each of the two DMA buffers used by `ws42_driver_send_data_stream`, a multiple of 4.
+ */
+#define WS42_DRIVER_CHUNK_SIZE 4096
+
+/**
+ * @brief Packs the next chunk of a `ws42_driver_send_data_stream` transfer.
+ *
+ * @param chunk DMA buffer to fill with `length` bytes.
+ * @param offset Offset of the chunk from the start of the transfer.
+ * @param length Number of bytes to write, at most `WS42_DRIVER_CHUNK_SIZE`.
+ * @param arg The argument given to `ws42_driver_send_data_stream`.
+ */
+typedef void (*ws42_driver_fill_cb_t)(uint8_t* chunk, uint32_t offset, uint32_t length, void* arg);
+
 /**
  * @brief Command enumeration for the WS42 display driver
  * This enumeration defines the various commands that can be sent to the WS42 display.
@@ -56,6 +110,11 @@ typedef enum {
   WS42_Driver_CMD_DATA_STOP       = 0x11,
   WS42_Driver_CMD_DISPLAY_REFRESH = 0x12,
   WS42_Driver_CMD_DATA_RED_START  = 0x13,
+  WS42_Driver_CMD_LUT_VCOM        = 0x20,
+  WS42_Driver_CMD_LUT_WW          = 0x21,
+  WS42_Driver_CMD_LUT_BW          = 0x22,
+  WS42_Driver_CMD_LUT_WB          = 0x23,
+  WS42_Driver_CMD_LUT_BB          = 0x24,
   WS42_Driver_CMD_PLL_CONTROL     = 0x30,
   WS42_Driver_CMD_TEMP_SENSOR_CAL = 0x40,
   WS42_Driver_CMD_TEMP_SENSOR_SEL = 0x41,
@@ -83,6 +142,65 @@ typedef enum {
   WS42_Driver_CMD_FORCE_TEMP      = 0xE5,
 } ws42_driver_cmd_e;
 
+/**
+ * @brief Waveforms the display can refresh with (See `ws42_driver_set_refresh_profile`).
+ */
+typedef enum {
+  /**
+   * @brief Tri-color waveform from the OTP, the display RAM holds the B/W plane at `WS42_Driver_CMD_DATA_BW_START`
+   * and the red plane at `WS42_Driver_CMD_DATA_RED_START`. Slowest, but the only one showing red.
+   */
+  WS42_DRIVER_PROFILE_FULL,
+
+  /**
+   * @brief Black and white waveform uploaded to the LUT registers, every pixel is driven. The B/W plane goes to
+   * `WS42_Driver_CMD_DATA_RED_START` (new data) and `WS42_Driver_CMD_DATA_BW_START` (old data) must be white.
+   */
+  WS42_DRIVER_PROFILE_FAST_BW,
+
+  /**
+   * @brief Black and white waveform uploaded to the LUT registers, only pixels that differ between the old data
+   * (`WS42_Driver_CMD_DATA_BW_START`) and the new data (`WS42_Driver_CMD_DATA_RED_START`) change. The old data must
+   * hold the image on the display.
+   */
+  WS42_DRIVER_PROFILE_PARTIAL,
+} ws42_driver_refresh_profile_e;
+
+/**
+ * @brief Power states of the display, from the most to the least power hungry.
+ */
+typedef enum {
+  /**
+   * @brief Booster and controller powered, ready to refresh.
+   */
+  WS42_DRIVER_POWER_ON,
+
+  /**
+   * @brief Booster off, the display RAM and settings are kept. Woken up with `WS42_Driver_CMD_POWER_ON`.
+   */
+  WS42_DRIVER_POWER_OFF,
+
+  /**
+   * @brief Controller in deep sleep, the display RAM and settings are lost. Woken up with a hardware reset and
+   * the init sequence.
+   */
+  WS42_DRIVER_POWER_DEEP_SLEEP,
+} ws42_driver_power_state_e;
+
+/**
+ * @brief What `ws42_driver_power_down` does between two updates.
+ */
+typedef enum {
+  WS42_DRIVER_POWER_POLICY_ALWAYS_ON,
+  WS42_DRIVER_POWER_POLICY_POWER_OFF,
+  WS42_DRIVER_POWER_POLICY_DEEP_SLEEP,
+
+  /**
+   * @brief Picks the deepest state that pays off for the update interval (See `WS42_DRIVER_SLEEP_PAYOFF_FACTOR`).
+   */
+  WS42_DRIVER_POWER_POLICY_AUTO,
+} ws42_driver_power_policy_e;
+
 /**
  * @brief Structure that defines the screen dimensions and GPIO pin configuration for the ESP32 SPI interface.
  */
@@ -98,7 +216,10 @@ typedef struct {
   uint16_t height;
 
   /**
-   * @brief GPIO pin connected to the SPI MISO (Master In Slave Out) line
+   * @brief GPIO pin connected to the SPI MISO (Master In Slave Out) line, `GPIO_NUM_NC` for the Waveshare module.
+   *
+   * The display talks 3-wire SPI, its replies come back on the MOSI line, so this pin is never read and must not be
+   * shared with `gpio_busy_pin`.
    */
   gpio_num_t spi_miso_pin;
 
@@ -121,7 +242,8 @@ typedef struct {
    * @brief GPIO pin connected to the display busy signal, this signal indicates when the display is busy processing
    * data and should not be sent new commands.
    *
-   * GPIO is configured as input, and the busy state is indicated by a low level on this pin.
+   * GPIO is configured as input with a rising edge interrupt, and the busy state is indicated by a low level on this
+   * pin.
    */
   gpio_num_t gpio_busy_pin;
 
@@ -160,7 +282,18 @@ uint8_t ws42_driver_init(const ws42_driver_config_t);
 /**
  * @brief Waits for the display to become ready for the next command.
  *
- * @note This function checks the busy pin of the display and waits until it is low.
+ * @note The task blocks on the busy pin rising edge interrupt, so it wakes as soon as the display is ready
+ * without polling the SPI bus. The pin is only looked at `WS42_DRIVER_BUSY_GUARD_US` after the last command.
+ *
+ * @param timeout_ms Longest time to wait, in milliseconds.
+ * @return uint8_t 1 when the display is ready, 0 when the timeout expired first.
+ */
+uint8_t ws42_driver_wait_busy(uint32_t timeout_ms);
+
+/**
+ * @brief Waits for the display to become ready for the next command, up to `WS42_DRIVER_BUSY_TIMEOUT_MS`.
+ *
+ * @note See `ws42_driver_wait_busy`, a timeout is logged and then ignored.
  */
 void ws42_driver_wait_busy_ack(void);
 
@@ -190,9 +323,161 @@ void ws42_driver_send_command(ws42_driver_cmd_e);
  */
 void ws42_driver_send_data(uint8_t);
 
+/**
+ * @brief Sends a command followed by its parameter block as one sequence, with the SPI bus acquired and CS kept
+ * low in between.
+ *
+ * @note Every transfer of the sequence is queued, the SPI driver doesn't allow polling transactions while queued
+ * ones hold CS. Up to 4 parameter bytes are sent inline in one transaction (`SPI_TRANS_USE_TXDATA`), longer
+ * blocks are split as in `ws42_driver_send_data_buffer`.
+ *
+ * @param cmd The command to send.
+ * @param data The parameter bytes, can be NULL when `data_length` is 0.
+ * @param data_length Number of parameter bytes.
+ */
+void ws42_driver_send_command_data(ws42_driver_cmd_e cmd, const uint8_t* data, uint32_t data_length);
+
 /**
  * @brief Sends a data buffer to the display.
  *
  * @note This function sends a data buffer to the display using the SPI interface, and sets the DC pin to HIGH.
+ * Any length is accepted, it is split in `WS42_DRIVER_MAX_TRANSFER_SIZE` transfers queued to the SPI DMA, with
+ * the next one queued while the current one is sent.
+ *
+ * Buffers in DMA capable memory, word aligned and with a length multiple of 4 (See `DMA_ATTR`) are sent as-is,
+ * others are copied chunk by chunk through `ws42_driver_send_data_stream`.
+ */
+void ws42_driver_send_data_buffer(const uint8_t* data, uint32_t data_length);
+
+/**
+ * @brief Sends `data_length` bytes produced by `fill` to the display, sets the DC pin to HIGH.
+ *
+ * @note Two `WS42_DRIVER_CHUNK_SIZE` DMA buffers are used in turns, `fill` packs the next chunk while the
+ * previous one is being sent, so the data never has to be staged whole in memory.
+ *
+ * @param fill Callback writing each chunk (See `ws42_driver_fill_cb_t`).
+ * @param arg Argument passed to `fill`.
+ * @param data_length Total number of bytes to send.
+ */
+void ws42_driver_send_data_stream(ws42_driver_fill_cb_t fill, void* arg, uint32_t data_length);
+
+/**
+ * @brief Enters the partial mode, commands that touch the display RAM or refresh it are limited to the
+ * partial window from now on.
+ */
+void ws42_driver_partial_enter(void);
+
+/**
+ * @brief Leaves the partial mode, the whole display RAM is addressed again.
+ */
+void ws42_driver_partial_exit(void);
+
+/**
+ * @brief Sets the partial window, used by the data transmission and refresh commands while in partial mode.
+ *
+ * @note The controller addresses columns in groups of 8 pixels, so `x` is rounded down and the window end is
+ * rounded up to a multiple of 8. Data for the window must be sent as `BIT_CAPACITY` rounded rows.
+ *
+ * @param x The x-coordinate of the top-left corner of the window.
+ * @param y The y-coordinate of the top-left corner of the window.
+ * @param width The width of the window.
+ * @param height The height of the window.
+ */
+void ws42_driver_set_partial_window(uint16_t x, uint16_t y, uint16_t width, uint16_t height);
+
+/**
+ * @brief Selects the waveform used by the next refreshes, sending the panel settings and LUTs when it changes.
+ *
+ * @note `ws42_driver_init` leaves the display in `WS42_DRIVER_PROFILE_FULL`. The profiles expect different data in
+ * the display RAM (See `ws42_driver_refresh_profile_e`).
+ *
+ * @param profile The refresh profile to use.
+ */
+void ws42_driver_set_refresh_profile(ws42_driver_refresh_profile_e profile);
+
+/**
+ * @brief Returns the refresh profile currently loaded in the display.
+ */
+ws42_driver_refresh_profile_e ws42_driver_get_refresh_profile(void);
+
+/**
+ * @brief Reads the panel temperature sensor.
+ *
+ * @note The display must be idle. The internal sensor is selected at init (`WS42_Driver_CMD_TEMP_SENSOR_SEL`),
+ * `WS42_Driver_CMD_TEMP_SENSOR_CAL` measures it and the reply is read back on the MOSI line (3-wire SPI).
+ *
+ * @param celsius Where the temperature is stored.
+ * @return uint8_t `ESP_OK` on success, `ESP_FAIL` if the display didn't answer or nothing drives the line (the
+ * reply reads all zeros or all ones), the caller then keeps `WS42_DRIVER_DEFAULT_CELSIUS`.
+ */
+uint8_t ws42_driver_read_temperature(int8_t* celsius);
+
+/**
+ * @brief Returns the panel temperature, reading the sensor only when the cached reading is older than
+ * `WS42_DRIVER_TEMPERATURE_MAX_AGE_MS`.
+ *
+ * @return int8_t The temperature in C, `WS42_DRIVER_DEFAULT_CELSIUS` if the sensor was never read.
+ */
+int8_t ws42_driver_get_temperature(void);
+
+/**
+ * @brief Checks whether a refresh profile is safe to use at the given temperature.
+ *
+ * @return uint8_t 1 if the profile can be used, 0 if `WS42_DRIVER_PROFILE_FULL` should be used instead.
+ */
+uint8_t ws42_driver_profile_allowed(ws42_driver_refresh_profile_e profile, int8_t celsius);
+
+/**
+ * @brief Predicts how long a refresh takes with the given profile and temperature.
+ *
+ * @note Starts from the duration measured at 25 C, scaled by temperature and corrected by the durations measured
+ * in `ws42_driver_wait_refresh`.
+ *
+ * @return uint32_t The expected duration in milliseconds.
+ */
+uint32_t ws42_driver_predict_refresh_ms(ws42_driver_refresh_profile_e profile, int8_t celsius);
+
+/**
+ * @brief Starts a display refresh with the loaded profile and the display RAM content.
+ */
+void ws42_driver_refresh(void);
+
+/**
+ * @brief Waits for the refresh started by `ws42_driver_refresh`, the timeout is derived from the predicted
+ * duration (See `ws42_driver_predict_refresh_ms`).
+ *
+ * @return uint8_t 1 once the refresh finished, 0 if it timed out.
+ */
+uint8_t ws42_driver_wait_refresh(void);
+
+/**
+ * @brief Sets how the display is powered down between updates, `WS42_DRIVER_POWER_POLICY_ALWAYS_ON` by default.
+ *
+ * @param policy The power policy to use.
+ * @param interval_ms Expected time between two updates, used by `WS42_DRIVER_POWER_POLICY_AUTO`.
+ */
+void ws42_driver_set_power_policy(ws42_driver_power_policy_e policy, uint32_t interval_ms);
+
+/**
+ * @brief Returns the current power state of the display.
+ */
+ws42_driver_power_state_e ws42_driver_get_power_state(void);
+
+/**
+ * @brief Returns a counter that changes every time the display RAM content is lost (See
+ * `WS42_DRIVER_POWER_DEEP_SLEEP`), so the next upload knows it must send everything.
+ */
+uint32_t ws42_driver_get_ram_epoch(void);
+
+/**
+ * @brief Powers the display down according to the power policy, meant to be called once a refresh finished.
+ */
+void ws42_driver_power_down(void);
+
+/**
+ * @brief Brings the display back to `WS42_DRIVER_POWER_ON`, must be called before sending data or refreshing.
+ *
+ * @note The time it takes is measured and used by `WS42_DRIVER_POWER_POLICY_AUTO`. After a deep sleep the refresh
+ * profile is back to `WS42_DRIVER_PROFILE_FULL`.
  */
-void ws42_driver_send_data_buffer(uint8_t* data, uint16_t data_length);
+void ws42_driver_wake(void);
@@ -1,11 +1,18 @@
 #include "hub.h"
 
 #include <dirent.h>
+#include <esp_attr.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <stdio.h>
 #include <sys/stat.h>
 
 #include "esp_log.h"
 #include "hub.h"
+#include "images/image_cache.h"
+#include "images/image_loader.h"
 #include "screen/renderer.h"
 #include "test_image.h"
 #include "utils/timing.h"
@@ -22,21 +29,51 @@ static const char* LOGO =
     "  |_|   \\__,_| .__/ \\___|_|  |_|  |_|\\__,_|_.__/ \n"
     "              | |                                \n"
     "              |_|                                \n";
-static uint8_t __frame_buffer[SCREEN_WIDTH * SCREEN_HEIGHT];
-static uint8_t __file_bitmap_buffer[CALC_INTERNAL_HEIGH * CALC_INTERNAL_WIDTH];
+// Planes are uploaded in place by the renderer, keep them DMA capable and word aligned.
+DMA_ATTR static uint8_t __frame_bw_plane[GRAPHICS_FRAME_BUFFER_PLANE_SIZE(SCREEN_WIDTH, SCREEN_HEIGHT)];
+DMA_ATTR static uint8_t __frame_red_plane[GRAPHICS_FRAME_BUFFER_PLANE_SIZE(SCREEN_WIDTH, SCREEN_HEIGHT)];
+static graphics_dirty_list_t __frame_dirty_list;
 static graphics_frame_buffer_t frame_buffer = {
     .width = SCREEN_WIDTH,
     .height = SCREEN_HEIGHT,
-    .buffer = __frame_buffer,
+    .stride = CALC_INTERNAL_WIDTH,
+    .bw_plane = __frame_bw_plane,
+    .red_plane = __frame_red_plane,
+    .dirty = &__frame_dirty_list,
 };
 
+// Standby planes the next image is loaded into while the current one is on
+// the display, only allocated when there is memory to spare.
+static graphics_frame_buffer_t standby_frame_buffer;
+static TaskHandle_t prefetch_task = NULL;
+static SemaphoreHandle_t prefetch_done = NULL;
+static ImageNode* prefetch_image = NULL;
+static uint8_t prefetch_pending = 0;
+static uint8_t prefetch_err = ESP_FAIL;
+static uint8_t prefetch_cached = 0;
+
 /** Public variables */
 
 e_paper_hub_system_stats_t e_paper_hub_dev;
 
 /** Private functions */
 
-void _append_image_path(const char* path) {
+void _select_refresh_profile(uint8_t uses_red) {
+  static uint8_t fast_refreshes = 0;
+
+  // The fast B/W waveform leaves some ghosting, clear it with a full refresh
+  // every now and then.
+  if (!uses_red && fast_refreshes < HUB_FULL_REFRESH_INTERVAL) {
+    graphics_renderer_set_refresh_profile(WS42_DRIVER_PROFILE_FAST_BW);
+    fast_refreshes++;
+  } else {
+    graphics_renderer_set_refresh_profile(WS42_DRIVER_PROFILE_FULL);
+    fast_refreshes = 0;
+  }
+}
+
+void _append_image_path(const char* path, const struct stat* st,
+                        uint8_t planes) {
   static ImageNode* last_node = NULL;
 
   const uint32_t path_length = strlen(path);
@@ -49,6 +86,9 @@ void _append_image_path(const char* path) {
 
   strcpy(new_path_buffer, path);
   new_node->path = new_path_buffer;
+  new_node->size = st->st_size;
+  new_node->mtime = st->st_mtime;
+  new_node->planes = planes;
 
   if (last_node) {
     last_node->next = new_node;
@@ -61,6 +101,70 @@ void _append_image_path(const char* path) {
   }
 }
 
+void _stream_rows(uint16_t y, uint16_t height, void* arg) {
+  graphics_renderer_stream_rows(y, height);
+}
+
+uint8_t _load_image(ImageNode* image, graphics_frame_buffer_t* fb,
+                    uint8_t* cached) {
+  *cached = image_cache_get(image->path, image->size, image->mtime, fb);
+  if (*cached) {
+    return ESP_OK;
+  }
+
+  const uint8_t err =
+      image_loader_load(image->path, image_loader_format_from_path(image->path),
+                        fb, HUB_IMAGE_Y_OFFSET, NULL, NULL);
+  if (!err) {
+    image_cache_put(image->path, image->size, image->mtime, fb);
+  }
+  return err;
+}
+
+void _prefetch_task(void* arg) {
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    prefetch_err = _load_image(prefetch_image, &standby_frame_buffer,
+                               &prefetch_cached);
+    xSemaphoreGive(prefetch_done);
+  }
+}
+
+void _start_prefetch(ImageNode* image) {
+  if (!prefetch_task || !image) {
+    return;
+  }
+
+  prefetch_image = image;
+  prefetch_pending = 1;
+  xTaskNotifyGive(prefetch_task);
+}
+
+// Swaps the standby planes into the frame buffer if they hold `image`.
+uint8_t _take_prefetched(ImageNode* image) {
+  if (!prefetch_pending) {
+    return 0;
+  }
+  xSemaphoreTake(prefetch_done, portMAX_DELAY);
+  prefetch_pending = 0;
+  if (prefetch_image != image || prefetch_err != ESP_OK) {
+    return 0;
+  }
+
+  // Swap only once the renderer is done with the current planes.
+  graphics_renderer_wait(portMAX_DELAY);
+  graphics_frame_buffer_t* fb = &e_paper_hub_dev.frame_buffer;
+  uint8_t* bw_plane = fb->bw_plane;
+  uint8_t* red_plane = fb->red_plane;
+  fb->bw_plane = standby_frame_buffer.bw_plane;
+  fb->red_plane = standby_frame_buffer.red_plane;
+  standby_frame_buffer.bw_plane = bw_plane;
+  standby_frame_buffer.red_plane = red_plane;
+  graphics_dirty_list_add(fb->dirty, 0, 0, fb->width, fb->height);
+  return 1;
+}
+
 void _print_sys_info() {
   printf(LOGO);
   printf(" Firmware Version: %s\n", FIRMWARE_VERSION);
@@ -81,6 +185,9 @@ void _driver_inits() {
     e_paper_hub_dev.status.screen_status = err;
     return;
   }
+  // Let the driver decide whether sleeping between images pays off.
+  ws42_driver_set_power_policy(WS42_DRIVER_POWER_POLICY_AUTO,
+                               HUB_RENDER_INTERVAL_MS);
 
   err = sdcard_driver_init(e_paper_hub_dev._settings.sdcard_config);
   if (err) {
@@ -90,9 +197,64 @@ void _driver_inits() {
 }
 
 void _configure_frame_renderer() {
+  graphics_dirty_list_init(&__frame_dirty_list,
+                           GRAPHICS_DIRTY_MERGE_WASTE_PERCENT);
   e_paper_hub_dev.frame_buffer = frame_buffer;
-  graphics_frame_buffer_clear(&frame_buffer, GRAPHICS_COLOR_WHITE);
-  graphics_renderer_attach(&frame_buffer);
+  graphics_frame_buffer_clear(&e_paper_hub_dev.frame_buffer,
+                              GRAPHICS_COLOR_WHITE);
+  graphics_renderer_attach(&e_paper_hub_dev.frame_buffer);
+}
+
+void _configure_image_cache() {
+  uint32_t budget = HUB_IMAGE_CACHE_BUDGET_PSRAM;
+  if (!heap_caps_get_total_size(MALLOC_CAP_SPIRAM)) {
+    // Without PSRAM the entries come out of the heap the prefetch planes and
+    // the loader buffers use, only what is free past the reserve is taken.
+    const uint32_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_DMA);
+    budget = free_bytes > HUB_PREFETCH_MIN_FREE_HEAP
+                 ? free_bytes - HUB_PREFETCH_MIN_FREE_HEAP
+                 : 0;
+    if (budget < HUB_IMAGE_CACHE_MIN_BUDGET_INTERNAL) {
+      ESP_LOGW(TAG, "Not enough memory to cache images");
+      budget = 0;
+    }
+  }
+  image_cache_init(budget);
+}
+
+void _configure_prefetch() {
+  const uint32_t plane_size =
+      GRAPHICS_FRAME_BUFFER_PLANE_SIZE(SCREEN_WIDTH, SCREEN_HEIGHT);
+
+  // A second frame is a nice to have, don't starve everything else for it.
+  if (heap_caps_get_free_size(MALLOC_CAP_DMA) <
+      (2 * plane_size) + HUB_PREFETCH_MIN_FREE_HEAP) {
+    ESP_LOGW(TAG, "Not enough memory to prefetch, images load when shown");
+    return;
+  }
+
+  uint8_t* bw_plane = heap_caps_malloc(plane_size, MALLOC_CAP_DMA);
+  uint8_t* red_plane = heap_caps_malloc(plane_size, MALLOC_CAP_DMA);
+  prefetch_done = xSemaphoreCreateBinary();
+  if (!bw_plane || !red_plane || !prefetch_done ||
+      xTaskCreate(_prefetch_task, "prefetch", HUB_PREFETCH_TASK_STACK_SIZE,
+                  NULL, HUB_PREFETCH_TASK_PRIORITY,
+                  &prefetch_task) != pdPASS) {
+    ESP_LOGW(TAG, "Prefetch setup failed, images load when shown");
+    heap_caps_free(bw_plane);
+    heap_caps_free(red_plane);
+    if (prefetch_done) {
+      vSemaphoreDelete(prefetch_done);
+      prefetch_done = NULL;
+    }
+    prefetch_task = NULL;
+    return;
+  }
+
+  standby_frame_buffer = frame_buffer;
+  standby_frame_buffer.bw_plane = bw_plane;
+  standby_frame_buffer.red_plane = red_plane;
+  standby_frame_buffer.dirty = NULL;
 }
 
 void _configure_image_loop() {
@@ -123,12 +285,17 @@ void _configure_image_loop() {
     // If the path referes to a File continue.
     if (stat(full_path, &st) == 0 && S_ISREG(st.st_mode)) {
       ESP_LOGI(TAG, "File: %s", dir->d_name);
-      const char* dot = strrchr(dir->d_name, '.');
 
-      // If BIN files found, append them to the linked list of images.
-      if (dot && (!strcmp(dot, ".BIN") || !strcmp(dot, ".bin"))) {
+      // If image files found, append them to the linked list of images.
+      // Broken containers are left out instead of failing on every loop.
+      const image_loader_format_e format =
+          image_loader_format_from_path(dir->d_name);
+      uint8_t planes;
+      if (format != IMAGE_LOADER_FORMAT_UNKNOWN &&
+          image_loader_probe(full_path, format, &frame_buffer, &planes) ==
+              ESP_OK) {
         ESP_LOGI(TAG, " _append_image_path(%s)", dir->d_name);
-        _append_image_path(full_path);
+        _append_image_path(full_path, &st, planes);
       }
     }
   }
@@ -157,6 +324,13 @@ void hub_initialize(const e_paper_hub_peripherals_config_t settings) {
   ESP_LOGI(TAG, "calling _configure_frame_renderer");
   _configure_frame_renderer();
 
+  // The cache is sized from the memory the prefetch planes leave.
+  ESP_LOGI(TAG, "calling _configure_prefetch");
+  _configure_prefetch();
+
+  ESP_LOGI(TAG, "calling _configure_image_cache");
+  _configure_image_cache();
+
   ESP_LOGI(TAG, "calling _configure_image_loop");
   _configure_image_loop();
 
@@ -177,25 +351,49 @@ void hub_render_next_image() {
     return;
   }
 
-  ESP_LOGI(TAG, "Reading file: %s", image->path);
-  FILE* image_file = fopen(image->path, "r");
-  if (!image_file) {
-    ESP_LOGE(TAG, "Image in %s not found", image->path);
-    return;
+  _select_refresh_profile(image->planes & IMAGE_CONTAINER_PLANE_RED);
+  // Only the lookup that decides where the shown image comes from counts.
+  if (_take_prefetched(image)) {
+    // Already loaded in the background, only the upload is left.
+    ESP_LOGI(TAG, "Showing prefetched image: %s", image->path);
+    image_cache_count_lookup(prefetch_cached);
+    graphics_renderer_update_async(NULL, NULL);
+  } else if (image_cache_get(image->path, image->size, image->mtime,
+                             &e_paper_hub_dev.frame_buffer)) {
+    ESP_LOGI(TAG, "Showing cached image: %s", image->path);
+    image_cache_count_lookup(1);
+    graphics_dirty_list_add(e_paper_hub_dev.frame_buffer.dirty, 0, 0,
+                            SCREEN_WIDTH, SCREEN_HEIGHT);
+    graphics_renderer_update_async(NULL, NULL);
+  } else {
+    image_cache_count_lookup(0);
+    if (graphics_renderer_stream_begin() != ESP_OK) {
+      return;
+    }
+
+    // Rows are uploaded by the renderer task while the rest is read.
+    ESP_LOGI(TAG, "Streaming image: %s", image->path);
+    const uint8_t err = image_loader_load(
+        image->path, image_loader_format_from_path(image->path),
+        &e_paper_hub_dev.frame_buffer, HUB_IMAGE_Y_OFFSET, _stream_rows, NULL);
+    if (err) {
+      // Keep the previous image on the display and move on to the next one.
+      ESP_LOGE(TAG, "Error loading %s, skipping it", image->path);
+      graphics_renderer_stream_cancel();
+    } else {
+      graphics_renderer_stream_end(NULL, NULL);
+      image_cache_put(image->path, image->size, image->mtime,
+                      &e_paper_hub_dev.frame_buffer);
+    }
   }
 
-  ESP_LOGI(TAG, "Reading image");
-  memset(__file_bitmap_buffer, 0x00, sizeof(__file_bitmap_buffer));
-  fread((char*)__file_bitmap_buffer, 1, sizeof(__file_bitmap_buffer), image_file);
-  graphics_frame_buffer_clear(&e_paper_hub_dev.frame_buffer, GRAPHICS_COLOR_WHITE);
-  graphics_frame_buffer_draw_bitmap(&e_paper_hub_dev.frame_buffer, 0, 21,
-                                    (const uint8_t*)__file_bitmap_buffer,
-                                    SCREEN_WIDTH, SCREEN_HEIGHT,
-                                    GRAPHICS_COLOR_BLACK);
-  fclose(image_file);
-
-  // Draw and render
-  ESP_LOGI(TAG, "Drawing image");
-  graphics_renderer_update();
-  image = image->next;
+  const image_cache_stats_t cache = image_cache_get_stats();
+  ESP_LOGI(TAG, "Image cache: %u hits, %u misses, %u entries (%u/%u bytes)",
+           (unsigned)cache.hits, (unsigned)cache.misses,
+           (unsigned)cache.entries, (unsigned)cache.used_bytes,
+           (unsigned)cache.budget_bytes);
+
+  // The next image is loaded while the panel refreshes and shows this one.
+  image = image->next ? image->next : e_paper_hub_dev.images;
+  _start_prefetch(image);
 }
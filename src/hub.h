@@ -20,11 +20,57 @@
  */
 #pragma once
 
+#include <time.h>
+
 #include "drivers/battery/max17048_i2c_driver.h"
 #include "drivers/display/waveshare_42in_spi_driver.h"
 #include "drivers/sdcard/sd_spi_driver.h"
 #include "screen/frame.h"
 
+/**
+ * @brief Number of fast B/W refreshes between two full tri-color refreshes, images without red use the fast
+ * waveform (See `WS42_DRIVER_PROFILE_FAST_BW`).
+ */
+#define HUB_FULL_REFRESH_INTERVAL 5
+
+/**
+ * @brief Time between two images, in milliseconds.
+ */
+#define HUB_RENDER_INTERVAL_MS 10000
+
+/**
+ * @brief Row of the screen where the images without header (.bin, .rle, .lz) start, rows above are left
+ * white. Containers carry their own placement.
+ */
+#define HUB_IMAGE_Y_OFFSET 21
+
+/**
+ * @brief Stack size and priority of the task that loads the next image in the background.
+ */
+#define HUB_PREFETCH_TASK_STACK_SIZE 4096
+#define HUB_PREFETCH_TASK_PRIORITY 4
+
+/**
+ * @brief Bytes of DMA capable memory that must stay free once the standby planes are allocated, below it
+ * there is no prefetch and images are loaded when shown.
+ */
+#define HUB_PREFETCH_MIN_FREE_HEAP (32 * 1024)
+
+/**
+ * @brief Byte budget of the decoded image cache (See `image_cache_init`) on boards with PSRAM.
+ */
+#define HUB_IMAGE_CACHE_BUDGET_PSRAM (2 * 1024 * 1024)
+
+/**
+ * @brief Without PSRAM the cache gets the DMA capable memory left once the prefetch planes are allocated, minus
+ * `HUB_PREFETCH_MIN_FREE_HEAP` so the reserve the prefetch was sized against stays free.
+ *
+ * A B/W frame takes ~15 KB and a tri-color one ~30 KB, so only a short loop skips the card and every cached frame
+ * is internal RAM the drivers and the loader can't use. Below this budget (one tri-color frame) the cache is
+ * disabled.
+ */
+#define HUB_IMAGE_CACHE_MIN_BUDGET_INTERNAL (32 * 1024)
+
 /**
  * @brief Represents a node in a singly linked list of image file paths.
  *
@@ -36,6 +82,18 @@ struct ImageNode {
    */
   char* path;
 
+  /**
+   * @brief Size in bytes and modification time of the file when the card was scanned, used to look the
+   * image up in the cache without touching the card.
+   */
+  uint32_t size;
+  time_t mtime;
+
+  /**
+   * @brief Planes stored in the file (See `image_loader_probe`), images without red get the fast refresh.
+   */
+  uint8_t planes;
+
   /**
    * @brief A pointer to the next ImageNode in the linked list, or NULL if this is the last node.
    */
@@ -149,5 +207,10 @@ void hub_initialize(const e_paper_hub_peripherals_config_t settings);
  *
  * This function advances to and displays the next image in the sequence
  * managed by the e-paper hub.
+ *
+ * @note Returns once the image is uploaded, the display keeps refreshing in
+ * the background (See `graphics_renderer_update_async`). Meanwhile the image
+ * after it is loaded into standby planes when memory allows, so the next call
+ * only has to upload it.
  */
 void hub_render_next_image(void);
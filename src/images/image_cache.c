@@ -0,0 +1,243 @@
+/**
+ * @file image_cache.c
+ * @author jdanypa@gmail.com (Elemeants)
+ */
+#include "image_cache.h"
+
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** Private variables */
+
+/**
+ * Decoded planes of one file, linked from the most to the least recently
+ * used.
+ */
+typedef struct image_cache_entry_s {
+  struct image_cache_entry_s *prev;
+  struct image_cache_entry_s *next;
+
+  char *path;
+  uint32_t file_size;
+  time_t mtime;
+
+  uint32_t plane_size;
+  uint8_t has_red;  // The red plane follows the B/W one in `data`
+  uint8_t *data;
+
+  // Accounted against the budget, bookkeeping included.
+  uint32_t bytes;
+} image_cache_entry_t;
+
+static const char *TAG = "image_cache";
+
+static SemaphoreHandle_t cache_lock = NULL;
+static image_cache_entry_t *most_recent = NULL;
+static image_cache_entry_t *least_recent = NULL;
+static image_cache_stats_t stats;
+
+/** Private functions */
+
+static void _image_cache_unlink(image_cache_entry_t *entry) {
+  if (entry->prev) {
+    entry->prev->next = entry->next;
+  } else {
+    most_recent = entry->next;
+  }
+  if (entry->next) {
+    entry->next->prev = entry->prev;
+  } else {
+    least_recent = entry->prev;
+  }
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static void _image_cache_push_front(image_cache_entry_t *entry) {
+  entry->prev = NULL;
+  entry->next = most_recent;
+  if (most_recent) {
+    most_recent->prev = entry;
+  } else {
+    least_recent = entry;
+  }
+  most_recent = entry;
+}
+
+static void _image_cache_remove(image_cache_entry_t *entry) {
+  _image_cache_unlink(entry);
+  stats.entries--;
+  stats.used_bytes -= entry->bytes;
+  heap_caps_free(entry->data);
+  free(entry->path);
+  free(entry);
+}
+
+static image_cache_entry_t *_image_cache_find(const char *path) {
+  for (image_cache_entry_t *entry = most_recent; entry; entry = entry->next) {
+    if (!strcmp(entry->path, path)) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+/**
+ * PSRAM first, internal RAM when there is none or it's full.
+ */
+static uint8_t *_image_cache_alloc(uint32_t size) {
+  uint8_t *data = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!data) {
+    data = heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+  }
+  return data;
+}
+
+static uint8_t _image_cache_plane_blank(const uint8_t *plane, uint32_t size) {
+  for (uint32_t idx = 0; idx < size; idx++) {
+    if (plane[idx]) {
+      return 0;
+    }
+  }
+  return 1;
+}
+
+static uint8_t _image_cache_fits(const graphics_frame_buffer_t *frame_buffer) {
+  return graphics_frame_buffer_get_stride(frame_buffer) ==
+             BIT_CAPACITY(frame_buffer->width) &&
+         !frame_buffer->origin_x && !frame_buffer->origin_y;
+}
+
+/** Public functions */
+
+void image_cache_init(uint32_t budget_bytes) {
+  if (cache_lock == NULL) {
+    cache_lock = xSemaphoreCreateMutex();
+    assert(cache_lock != NULL);
+  }
+
+  xSemaphoreTake(cache_lock, portMAX_DELAY);
+  while (least_recent) {
+    _image_cache_remove(least_recent);
+  }
+  memset(&stats, 0x00, sizeof(stats));
+  stats.budget_bytes = budget_bytes;
+  xSemaphoreGive(cache_lock);
+}
+
+uint8_t image_cache_get(const char *path, uint32_t file_size, time_t mtime,
+                        graphics_frame_buffer_t *frame_buffer) {
+  const uint32_t plane_size = GRAPHICS_FRAME_BUFFER_PLANE_SIZE(
+      frame_buffer->width, frame_buffer->height);
+
+  xSemaphoreTake(cache_lock, portMAX_DELAY);
+  image_cache_entry_t *entry = _image_cache_find(path);
+  if (entry && (entry->file_size != file_size || entry->mtime != mtime)) {
+    // The file changed on the card, this entry is never served again.
+    _image_cache_remove(entry);
+    entry = NULL;
+  }
+  if (!entry || entry->plane_size != plane_size ||
+      !_image_cache_fits(frame_buffer)) {
+    xSemaphoreGive(cache_lock);
+    return 0;
+  }
+
+  memcpy(frame_buffer->bw_plane, entry->data, plane_size);
+  if (entry->has_red) {
+    memcpy(frame_buffer->red_plane, &entry->data[plane_size], plane_size);
+  } else {
+    memset(frame_buffer->red_plane, 0x00, plane_size);
+  }
+
+  _image_cache_unlink(entry);
+  _image_cache_push_front(entry);
+  xSemaphoreGive(cache_lock);
+  return 1;
+}
+
+void image_cache_put(const char *path, uint32_t file_size, time_t mtime,
+                     const graphics_frame_buffer_t *frame_buffer) {
+  if (!_image_cache_fits(frame_buffer)) {
+    return;
+  }
+
+  const uint32_t plane_size = GRAPHICS_FRAME_BUFFER_PLANE_SIZE(
+      frame_buffer->width, frame_buffer->height);
+  const uint8_t has_red =
+      !_image_cache_plane_blank(frame_buffer->red_plane, plane_size);
+  const uint32_t data_size = has_red ? (2 * plane_size) : plane_size;
+  const uint32_t bytes =
+      data_size + sizeof(image_cache_entry_t) + strlen(path) + 1;
+
+  xSemaphoreTake(cache_lock, portMAX_DELAY);
+
+  // An older version of the file is never read again.
+  image_cache_entry_t *stale = _image_cache_find(path);
+  if (stale) {
+    _image_cache_remove(stale);
+  }
+
+  if (bytes > stats.budget_bytes) {
+    xSemaphoreGive(cache_lock);
+    return;
+  }
+  while (stats.used_bytes + bytes > stats.budget_bytes) {
+    _image_cache_remove(least_recent);
+  }
+
+  image_cache_entry_t *entry = calloc(1, sizeof(image_cache_entry_t));
+  char *path_copy = strdup(path);
+  uint8_t *data = _image_cache_alloc(data_size);
+  while (!data && least_recent) {
+    // Within budget but the heap is short, make room.
+    _image_cache_remove(least_recent);
+    data = _image_cache_alloc(data_size);
+  }
+  if (!entry || !path_copy || !data) {
+    ESP_LOGW(TAG, "Not enough memory to cache %s", path);
+    free(entry);
+    free(path_copy);
+    heap_caps_free(data);
+    xSemaphoreGive(cache_lock);
+    return;
+  }
+
+  memcpy(data, frame_buffer->bw_plane, plane_size);
+  if (has_red) {
+    memcpy(&data[plane_size], frame_buffer->red_plane, plane_size);
+  }
+  entry->path = path_copy;
+  entry->file_size = file_size;
+  entry->mtime = mtime;
+  entry->plane_size = plane_size;
+  entry->has_red = has_red;
+  entry->data = data;
+  entry->bytes = bytes;
+
+  _image_cache_push_front(entry);
+  stats.entries++;
+  stats.used_bytes += bytes;
+  xSemaphoreGive(cache_lock);
+}
+
+void image_cache_count_lookup(uint8_t hit) {
+  xSemaphoreTake(cache_lock, portMAX_DELAY);
+  if (hit) {
+    stats.hits++;
+  } else {
+    stats.misses++;
+  }
+  xSemaphoreGive(cache_lock);
+}
+
+image_cache_stats_t image_cache_get_stats(void) {
+  xSemaphoreTake(cache_lock, portMAX_DELAY);
+  const image_cache_stats_t current = stats;
+  xSemaphoreGive(cache_lock);
+  return current;
+}
@@ -0,0 +1,83 @@
+/**
+ * @file image_cache.h
+ * @author jdanypa@gmail.com (Elemeants)
+ * @brief LRU cache of decoded images.
+ *
+ * Entries hold the planes of a whole frame as the image loader left them, keyed by the file path, size and
+ * modification time, so a file changed on the card is never served from the cache. The least recently used
+ * entries are evicted to stay within the byte budget given to `image_cache_init`.
+ *
+ * Entries are placed in PSRAM when the board has it and in internal RAM otherwise. A red plane that is
+ * all zero (black and white images) isn't stored.
+ *
+ * All functions can be called from any task.
+ */
+#pragma once
+
+#include <time.h>
+
+#include "screen/frame.h"
+
+/**
+ * @brief Usage counters of the cache.
+ */
+typedef struct {
+  /**
+   * @brief Images served from the cache or not, as recorded by `image_cache_count_lookup`.
+   */
+  uint32_t hits;
+  uint32_t misses;
+  uint16_t entries;
+
+  /**
+   * @brief Bytes accounted against the budget, including the bookkeeping of every entry.
+   */
+  uint32_t used_bytes;
+  uint32_t budget_bytes;
+} image_cache_stats_t;
+
+/**
+ * @brief Initializes the cache, must be called before any other cache function.
+ *
+ * @param budget_bytes Most bytes the entries may take, zero disables the cache.
+ */
+void image_cache_init(uint32_t budget_bytes);
+
+/**
+ * @brief Copies the cached planes of a file into the frame buffer. An entry for an older version of the file
+ * is evicted.
+ *
+ * @note The lookup isn't counted, a caller may look an image up more than once before showing it (See
+ * `image_cache_count_lookup`).
+ *
+ * @param path Path of the image file.
+ * @param file_size Size of the file in bytes.
+ * @param mtime Modification time of the file.
+ * @param frame_buffer Frame buffer to fill, must not be a view and must match the size of the cached one.
+ * @return uint8_t 1 on a hit, 0 when the file isn't cached (the frame buffer is untouched).
+ */
+uint8_t image_cache_get(const char *path, uint32_t file_size, time_t mtime, graphics_frame_buffer_t *frame_buffer);
+
+/**
+ * @brief Stores the planes of the frame buffer as the decoded image of a file, evicting the least recently
+ * used entries as needed. Images that don't fit the budget or the free memory are not cached.
+ *
+ * @param path Path of the image file.
+ * @param file_size Size of the file in bytes.
+ * @param mtime Modification time of the file.
+ * @param frame_buffer Frame buffer holding the decoded image, must not be a view.
+ */
+void image_cache_put(const char *path, uint32_t file_size, time_t mtime,
+                     const graphics_frame_buffer_t *frame_buffer);
+
+/**
+ * @brief Counts an image about to be shown as a hit or a miss, once per image whatever the number of lookups.
+ *
+ * @param hit 1 if the image came from the cache, 0 if it was loaded from the card.
+ */
+void image_cache_count_lookup(uint8_t hit);
+
+/**
+ * @brief Returns the usage counters of the cache (See `image_cache_stats_t`).
+ */
+image_cache_stats_t image_cache_get_stats(void);
@@ -0,0 +1,86 @@
+/**
+ * @file image_container.c
+ * @author jdanypa@gmail.com (Elemeants)
+ */
+#include "image_container.h"
+
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_rom_crc.h>
+#include <string.h>
+
+/** Private variables */
+
+static const char *TAG = "image_container";
+
+/** Private functions */
+
+static inline uint16_t _image_container_u16(const uint8_t *raw) {
+  return raw[0] | (raw[1] << 8);
+}
+
+static inline uint32_t _image_container_u32(const uint8_t *raw) {
+  return raw[0] | (raw[1] << 8) | (raw[2] << 16) | ((uint32_t)raw[3] << 24);
+}
+
+/** Public functions */
+
+uint8_t image_container_parse_header(const uint8_t *raw, uint16_t screen_width,
+                                     uint16_t screen_height,
+                                     image_container_header_t *header) {
+  if (memcmp(raw, IMAGE_CONTAINER_MAGIC, 4)) {
+    ESP_LOGE(TAG, "Not an image container");
+    return ESP_FAIL;
+  }
+
+  header->version = raw[4];
+  header->planes = raw[5];
+  header->compression = (image_container_compression_e)raw[6];
+  header->width = _image_container_u16(&raw[8]);
+  header->height = _image_container_u16(&raw[10]);
+  header->x = _image_container_u16(&raw[12]);
+  header->y = _image_container_u16(&raw[14]);
+  header->data_size = _image_container_u32(&raw[16]);
+  header->crc = _image_container_u32(&raw[20]);
+
+  if (header->version != IMAGE_CONTAINER_VERSION) {
+    ESP_LOGE(TAG, "Unsupported container version %d", header->version);
+    return ESP_FAIL;
+  } else if (!header->planes ||
+             (header->planes &
+              ~(IMAGE_CONTAINER_PLANE_BW | IMAGE_CONTAINER_PLANE_RED))) {
+    ESP_LOGE(TAG, "Invalid planes 0x%02X", header->planes);
+    return ESP_FAIL;
+  } else if (header->compression > IMAGE_CONTAINER_COMPRESSION_LZ) {
+    ESP_LOGE(TAG, "Unknown compression %d", header->compression);
+    return ESP_FAIL;
+  }
+
+  if (!header->width || !header->height || header->x % 8 ||
+      ((uint32_t)header->x + header->width) > screen_width ||
+      ((uint32_t)header->y + header->height) > screen_height) {
+    ESP_LOGE(TAG, "Image %dx%d at (%d, %d) doesn't fit the %dx%d screen",
+             header->width, header->height, header->x, header->y,
+             screen_width, screen_height);
+    return ESP_FAIL;
+  }
+
+  // Uncompressed data has an exact size, anything else is a broken file.
+  const uint8_t plane_count =
+      (header->planes & IMAGE_CONTAINER_PLANE_BW ? 1 : 0) +
+      (header->planes & IMAGE_CONTAINER_PLANE_RED ? 1 : 0);
+  const uint32_t plane_bytes =
+      (uint32_t)BIT_CAPACITY(header->width) * header->height;
+  if (header->compression == IMAGE_CONTAINER_COMPRESSION_NONE &&
+      header->data_size != plane_count * plane_bytes) {
+    ESP_LOGE(TAG, "Data size %u doesn't match the image",
+             (unsigned)header->data_size);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+uint32_t image_container_crc32(uint32_t crc, const uint8_t *data,
+                               uint32_t length) {
+  return esp_rom_crc32_le(crc, data, length);
+}
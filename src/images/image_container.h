@@ -0,0 +1,83 @@
+/**
+ * @file image_container.h
+ * @author jdanypa@gmail.com (Elemeants)
+ * @brief Versioned tri-color image container (`.epi`).
+ *
+ * A file starts with a `IMAGE_CONTAINER_HEADER_SIZE` bytes header, multi-byte fields are little endian:
+ *
+ * | Offset | Size | Field                                                              |
+ * | ------ | ---- | ------------------------------------------------------------------ |
+ * | 0      | 4    | Magic, `IMAGE_CONTAINER_MAGIC`                                     |
+ * | 4      | 1    | Version, `IMAGE_CONTAINER_VERSION`                                 |
+ * | 5      | 1    | Planes present (`IMAGE_CONTAINER_PLANE_BW`, `IMAGE_CONTAINER_PLANE_RED`) |
+ * | 6      | 1    | Compression (See `image_container_compression_e`)                  |
+ * | 7      | 1    | Reserved, 0                                                        |
+ * | 8      | 2    | Width in pixels                                                    |
+ * | 10     | 2    | Height in pixels                                                   |
+ * | 12     | 2    | X of the top left corner on the screen, a multiple of 8            |
+ * | 14     | 2    | Y of the top left corner on the screen                             |
+ * | 16     | 4    | Size in bytes of the data following the header                     |
+ * | 20     | 4    | CRC-32 (zlib) of the first 20 header bytes followed by the data     |
+ *
+ * The data holds, for each row top to bottom, the row of every present plane in B/W then red order, each
+ * `BIT_CAPACITY(width)` bytes MSB-first with the frame buffer polarity (a set B/W bit is white, a set red bit
+ * is red), compressed as one stream. Only the image area is stored, the rest of the screen is white.
+ */
+#pragma once
+
+#include <stdint.h>
+
+#include "utils/defs.h"
+
+#define IMAGE_CONTAINER_MAGIC "EPIM"
+#define IMAGE_CONTAINER_VERSION 1
+#define IMAGE_CONTAINER_HEADER_SIZE 24
+
+#define IMAGE_CONTAINER_PLANE_BW _BIT(0)
+#define IMAGE_CONTAINER_PLANE_RED _BIT(1)
+
+/**
+ * @brief Compression of the container data (See `image_decoder.h`).
+ */
+typedef enum {
+  IMAGE_CONTAINER_COMPRESSION_NONE,
+  IMAGE_CONTAINER_COMPRESSION_PACKBITS,
+  IMAGE_CONTAINER_COMPRESSION_LZ,
+} image_container_compression_e;
+
+/**
+ * @brief Decoded container header.
+ */
+typedef struct {
+  uint8_t version;
+  uint8_t planes;
+  image_container_compression_e compression;
+  uint16_t width;
+  uint16_t height;
+  uint16_t x;
+  uint16_t y;
+  uint32_t data_size;
+  uint32_t crc;
+} image_container_header_t;
+
+/**
+ * @brief Decodes and validates a container header against the screen it will be shown on.
+ *
+ * @param raw The first `IMAGE_CONTAINER_HEADER_SIZE` bytes of the file.
+ * @param screen_width Width in pixels of the frame the image is loaded into.
+ * @param screen_height Height in pixels of the frame the image is loaded into.
+ * @param header Decoded header, only valid when ESP_OK is returned.
+ * @return uint8_t ESP_OK for a supported header whose image fits the screen, ESP_FAIL otherwise.
+ */
+uint8_t image_container_parse_header(const uint8_t *raw, uint16_t screen_width, uint16_t screen_height,
+                                     image_container_header_t *header);
+
+/**
+ * @brief Continues the CRC-32 of a container with more bytes.
+ *
+ * @param crc CRC of the bytes so far, 0 to start.
+ * @param data Next bytes.
+ * @param length Number of bytes.
+ * @return uint32_t CRC including `data`.
+ */
+uint32_t image_container_crc32(uint32_t crc, const uint8_t *data, uint32_t length);
@@ -0,0 +1,191 @@
+/**
+ * @file image_decoder.c
+ * @author jdanypa@gmail.com (Elemeants)
+ */
+#include "image_decoder.h"
+
+#include <string.h>
+
+/** Private variables */
+
+#define LZ_WINDOW_MASK ((1 << IMAGE_DECODER_LZ_WINDOW_BITS) - 1)
+
+typedef enum {
+  PACKBITS_STEP_HEADER,
+  PACKBITS_STEP_LITERAL,
+  PACKBITS_STEP_RUN_VALUE,
+  PACKBITS_STEP_RUN,
+} packbits_step_e;
+
+typedef enum {
+  LZ_STEP_TAG,
+  LZ_STEP_LITERAL,
+  LZ_STEP_OFFSET,
+  LZ_STEP_LENGTH,
+  LZ_STEP_COPY,
+} lz_step_e;
+
+/** Private functions */
+
+static uint32_t _image_decoder_packbits(image_decoder_t *decoder,
+                                        const uint8_t *in, uint32_t in_length,
+                                        uint32_t *in_used, uint8_t *out,
+                                        uint32_t out_length) {
+  uint32_t used = 0;
+  uint32_t produced = 0;
+
+  while (produced < out_length) {
+    if (decoder->step == PACKBITS_STEP_RUN) {
+      const uint32_t room = out_length - produced;
+      const uint32_t count =
+          decoder->remaining < room ? decoder->remaining : room;
+      memset(&out[produced], decoder->value, count);
+      produced += count;
+      decoder->remaining -= count;
+      if (!decoder->remaining) {
+        decoder->step = PACKBITS_STEP_HEADER;
+      }
+      continue;
+    }
+
+    if (used == in_length) {
+      break;
+    }
+
+    if (decoder->step == PACKBITS_STEP_LITERAL) {
+      const uint32_t room = out_length - produced;
+      uint32_t count = decoder->remaining < room ? decoder->remaining : room;
+      count = count < (in_length - used) ? count : (in_length - used);
+      memcpy(&out[produced], &in[used], count);
+      produced += count;
+      used += count;
+      decoder->remaining -= count;
+      if (!decoder->remaining) {
+        decoder->step = PACKBITS_STEP_HEADER;
+      }
+    } else if (decoder->step == PACKBITS_STEP_RUN_VALUE) {
+      decoder->value = in[used++];
+      decoder->step = PACKBITS_STEP_RUN;
+    } else {
+      const uint8_t header = in[used++];
+      if (header < 128) {
+        decoder->remaining = header + 1;
+        decoder->step = PACKBITS_STEP_LITERAL;
+      } else if (header > 128) {
+        decoder->remaining = 257 - header;
+        decoder->step = PACKBITS_STEP_RUN_VALUE;
+      }
+    }
+  }
+
+  *in_used = used;
+  return produced;
+}
+
+/**
+ * Reads the next `count` bits MSB-first into `value`, returns 0 when the input
+ * ran out first (the bits read so far are kept for the next call).
+ */
+static uint8_t _image_decoder_lz_bits(image_decoder_t *decoder,
+                                      const uint8_t *in, uint32_t in_length,
+                                      uint32_t *used, uint8_t count,
+                                      uint16_t *value) {
+  while (decoder->field_bits < count) {
+    if (!decoder->bit_mask) {
+      if (*used == in_length) {
+        return 0;
+      }
+      decoder->current = in[(*used)++];
+      decoder->bit_mask = 0x80;
+    }
+    decoder->field = (decoder->field << 1) |
+                     ((decoder->current & decoder->bit_mask) ? 1 : 0);
+    decoder->bit_mask >>= 1;
+    decoder->field_bits++;
+  }
+
+  *value = decoder->field;
+  decoder->field = 0;
+  decoder->field_bits = 0;
+  return 1;
+}
+
+static inline void _image_decoder_lz_emit(image_decoder_t *decoder,
+                                          uint8_t *out, uint8_t byte) {
+  *out = byte;
+  decoder->window[decoder->head++ & LZ_WINDOW_MASK] = byte;
+}
+
+static uint32_t _image_decoder_lz(image_decoder_t *decoder, const uint8_t *in,
+                                  uint32_t in_length, uint32_t *in_used,
+                                  uint8_t *out, uint32_t out_length) {
+  uint32_t used = 0;
+  uint32_t produced = 0;
+  uint16_t value;
+
+  while (produced < out_length) {
+    if (decoder->step == LZ_STEP_COPY) {
+      while (decoder->remaining && produced < out_length) {
+        const uint8_t byte =
+            decoder->window[(decoder->head - decoder->offset) & LZ_WINDOW_MASK];
+        _image_decoder_lz_emit(decoder, &out[produced++], byte);
+        decoder->remaining--;
+      }
+      if (!decoder->remaining) {
+        decoder->step = LZ_STEP_TAG;
+      }
+      continue;
+    }
+
+    uint8_t bits = 1;
+    if (decoder->step == LZ_STEP_LITERAL) {
+      bits = 8;
+    } else if (decoder->step == LZ_STEP_OFFSET) {
+      bits = IMAGE_DECODER_LZ_WINDOW_BITS;
+    } else if (decoder->step == LZ_STEP_LENGTH) {
+      bits = IMAGE_DECODER_LZ_LOOKAHEAD_BITS;
+    }
+    if (!_image_decoder_lz_bits(decoder, in, in_length, &used, bits, &value)) {
+      break;
+    }
+
+    switch (decoder->step) {
+      case LZ_STEP_TAG:
+        decoder->step = value ? LZ_STEP_LITERAL : LZ_STEP_OFFSET;
+        break;
+      case LZ_STEP_LITERAL:
+        _image_decoder_lz_emit(decoder, &out[produced++], value);
+        decoder->step = LZ_STEP_TAG;
+        break;
+      case LZ_STEP_OFFSET:
+        decoder->offset = value + 1;
+        decoder->step = LZ_STEP_LENGTH;
+        break;
+      default:
+        decoder->remaining = value + 1;
+        decoder->step = LZ_STEP_COPY;
+        break;
+    }
+  }
+
+  *in_used = used;
+  return produced;
+}
+
+/** Public functions */
+
+void image_decoder_init(image_decoder_t *decoder, image_decoder_type_e type) {
+  // The LZ history starts zeroed, as heatshrink expects.
+  memset(decoder, 0x00, sizeof(image_decoder_t));
+  decoder->type = type;
+}
+
+uint32_t image_decoder_run(image_decoder_t *decoder, const uint8_t *in,
+                           uint32_t in_length, uint32_t *in_used, uint8_t *out,
+                           uint32_t out_length) {
+  if (decoder->type == IMAGE_DECODER_LZ) {
+    return _image_decoder_lz(decoder, in, in_length, in_used, out, out_length);
+  }
+  return _image_decoder_packbits(decoder, in, in_length, in_used, out,
+                                 out_length);
+}
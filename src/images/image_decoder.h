@@ -0,0 +1,87 @@
+/**
+ * @file image_decoder.h
+ * @author jdanypa@gmail.com (Elemeants)
+ * @brief Incremental decoders for the compressed image formats.
+ *
+ * Decoders are fed the compressed file a chunk at a time and write the decoded bytes straight to their
+ * destination, they keep just enough state to resume where the previous chunk ended, so the compressed file
+ * is never held whole in memory.
+ *
+ * Two formats are supported:
+ * - PackBits (`.rle`): a header byte `n` is followed by `n + 1` literal bytes when `n` is 0..127, or by one
+ *   byte repeated `257 - n` times when `n` is 129..255, 128 is skipped.
+ * - LZSS (`.lz`): the heatshrink bit stream with a `IMAGE_DECODER_LZ_WINDOW_BITS` window and
+ *   `IMAGE_DECODER_LZ_LOOKAHEAD_BITS` lookahead (`heatshrink -e -w 8 -l 4`). A set tag bit is followed by an
+ *   8 bit literal, a cleared one by the back-reference offset minus one and length minus one.
+ */
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Window size of the LZ format, in bits, the decoder keeps a history of `1 << bits` bytes.
+ */
+#define IMAGE_DECODER_LZ_WINDOW_BITS 8
+
+/**
+ * @brief Lookahead size of the LZ format, in bits, back-references copy at most `1 << bits` bytes.
+ */
+#define IMAGE_DECODER_LZ_LOOKAHEAD_BITS 4
+
+/**
+ * @brief Compression of the image data.
+ */
+typedef enum {
+  IMAGE_DECODER_PACKBITS,
+  IMAGE_DECODER_LZ,
+} image_decoder_type_e;
+
+/**
+ * @brief State of a decoder between two chunks, fields are private.
+ */
+typedef struct {
+  image_decoder_type_e type;
+
+  // Step of the current token, see `image_decoder.c`.
+  uint8_t step;
+
+  // Bytes left to emit by the current token.
+  uint16_t remaining;
+
+  // PackBits repeated byte.
+  uint8_t value;
+
+  // LZ bit reader and history.
+  uint8_t current;
+  uint8_t bit_mask;
+  uint8_t field_bits;
+  uint16_t field;
+  uint16_t offset;
+  uint16_t head;
+  uint8_t window[1 << IMAGE_DECODER_LZ_WINDOW_BITS];
+} image_decoder_t;
+
+/**
+ * @brief Initializes a decoder at the start of a stream.
+ *
+ * @param decoder Decoder to initialize.
+ * @param type Compression of the stream.
+ */
+void image_decoder_init(image_decoder_t *decoder, image_decoder_type_e type);
+
+/**
+ * @brief Decodes the next chunk of the stream.
+ *
+ * Stops once the input is consumed or the output is full, whatever is left of the input has to be given
+ * again on the next call.
+ *
+ * @param decoder Decoder state.
+ * @param in Compressed bytes.
+ * @param in_length Number of compressed bytes.
+ * @param in_used Set to the number of compressed bytes consumed.
+ * @param out Destination of the decoded bytes.
+ * @param out_length Room left in `out`.
+ * @return uint32_t Number of bytes written to `out`.
+ */
+uint32_t image_decoder_run(image_decoder_t *decoder, const uint8_t *in, uint32_t in_length, uint32_t *in_used,
+                           uint8_t *out, uint32_t out_length);
@@ -0,0 +1,479 @@
+/**
+ * @file image_loader.c
+ * @author jdanypa@gmail.com (Elemeants)
+ */
+#include "image_loader.h"
+
+#include <esp_err.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include "image_container.h"
+#include "image_decoder.h"
+
+/** Private variables */
+
+// Files without header have no size limit.
+#define IMAGE_LOADER_UNBOUNDED UINT32_MAX
+
+static const char *TAG = "image_loader";
+
+/**
+ * Where the image lands in the frame buffer, where the next loaded byte goes
+ * and which rows are finished.
+ */
+typedef struct {
+  graphics_frame_buffer_t *frame_buffer;
+  uint16_t stride;
+
+  // Image area, each row holds a `row_bytes` segment of every plane in
+  // `planes`, B/W first.
+  uint16_t x_byte;
+  uint16_t y;
+  uint16_t height;
+  uint16_t row_bytes;
+  uint8_t planes;
+  uint8_t pad_mask;  // Bits of the last row byte past the image width
+  uint8_t contiguous;
+
+  // Next byte, `column` spans several rows when the image is contiguous.
+  uint16_t row;
+  uint8_t plane;
+  uint32_t column;
+
+  uint16_t reported;
+  image_loader_rows_cb_t on_rows;
+  void *arg;
+} image_loader_progress_t;
+
+/**
+ * Bytes left in the file and their running CRC, only containers are bounded
+ * and checked.
+ */
+typedef struct {
+  FILE *file;
+  uint32_t offset;
+  uint32_t left;
+  uint32_t crc;
+} image_loader_source_t;
+
+/**
+ * Compressed input chunk and decoder state, allocated for each load.
+ */
+typedef struct {
+  uint8_t input[IMAGE_LOADER_INPUT_SIZE];
+  image_decoder_t decoder;
+} image_loader_stream_t;
+
+/** Private functions */
+
+static inline uint8_t _image_loader_first_plane(uint8_t planes) {
+  return (planes & IMAGE_CONTAINER_PLANE_BW) ? IMAGE_CONTAINER_PLANE_BW
+                                             : IMAGE_CONTAINER_PLANE_RED;
+}
+
+static inline uint8_t _image_loader_done(
+    const image_loader_progress_t *progress) {
+  return progress->row >= progress->height;
+}
+
+/**
+ * Paints everything the file doesn't hold: the rows around the image, the
+ * columns beside it and the absent planes.
+ */
+static void _image_loader_prepare(image_loader_progress_t *progress) {
+  graphics_frame_buffer_t *frame_buffer = progress->frame_buffer;
+  const uint16_t stride = progress->stride;
+  const uint16_t right = progress->x_byte + progress->row_bytes;
+
+  memset(frame_buffer->bw_plane, 0xFF, (uint32_t)progress->y * stride);
+  memset(frame_buffer->red_plane, 0x00, (uint32_t)progress->y * stride);
+  for (uint16_t row = progress->y; row < progress->y + progress->height;
+       row++) {
+    uint8_t *bw = &frame_buffer->bw_plane[(uint32_t)row * stride];
+    uint8_t *red = &frame_buffer->red_plane[(uint32_t)row * stride];
+    memset(bw, 0xFF, progress->x_byte);
+    memset(&bw[right], 0xFF, stride - right);
+    memset(red, 0x00, progress->x_byte);
+    memset(&red[right], 0x00, stride - right);
+    if (!(progress->planes & IMAGE_CONTAINER_PLANE_BW)) {
+      memset(&bw[progress->x_byte], 0xFF, progress->row_bytes);
+    }
+    if (!(progress->planes & IMAGE_CONTAINER_PLANE_RED)) {
+      memset(&red[progress->x_byte], 0x00, progress->row_bytes);
+    }
+  }
+
+  const uint32_t below = (uint32_t)(progress->y + progress->height) * stride;
+  const uint32_t plane_size = (uint32_t)frame_buffer->height * stride;
+  memset(&frame_buffer->bw_plane[below], 0xFF, plane_size - below);
+  memset(&frame_buffer->red_plane[below], 0x00, plane_size - below);
+}
+
+static void _image_loader_report(image_loader_progress_t *progress,
+                                 uint16_t finished) {
+  if (finished <= progress->reported) {
+    return;
+  }
+
+  if (progress->on_rows) {
+    progress->on_rows(progress->reported, finished - progress->reported,
+                      progress->arg);
+  }
+  progress->reported = finished;
+}
+
+/**
+ * Where the next byte goes, `length` is the number of bytes that can be
+ * written there in one go.
+ */
+static uint8_t *_image_loader_target(const image_loader_progress_t *progress,
+                                     uint32_t *length) {
+  uint8_t *plane = progress->plane == IMAGE_CONTAINER_PLANE_BW
+                       ? progress->frame_buffer->bw_plane
+                       : progress->frame_buffer->red_plane;
+  *length = progress->contiguous
+                ? (uint32_t)(progress->height - progress->row) *
+                          progress->row_bytes -
+                      progress->column
+                : progress->row_bytes - progress->column;
+  return &plane[(uint32_t)(progress->y + progress->row) * progress->stride +
+                progress->x_byte + progress->column];
+}
+
+static void _image_loader_advance(image_loader_progress_t *progress,
+                                  uint32_t length) {
+  progress->column += length;
+  while (progress->column >= progress->row_bytes &&
+         !_image_loader_done(progress)) {
+    progress->column -= progress->row_bytes;
+
+    // The width padding bits are not part of the image, keep them white.
+    uint8_t *plane = progress->plane == IMAGE_CONTAINER_PLANE_BW
+                         ? progress->frame_buffer->bw_plane
+                         : progress->frame_buffer->red_plane;
+    uint8_t *last = &plane[(uint32_t)(progress->y + progress->row) *
+                               progress->stride +
+                           progress->x_byte + progress->row_bytes - 1];
+    if (progress->plane == IMAGE_CONTAINER_PLANE_BW) {
+      *last |= progress->pad_mask;
+    } else {
+      *last &= ~progress->pad_mask;
+    }
+
+    if (progress->plane == IMAGE_CONTAINER_PLANE_BW &&
+        (progress->planes & IMAGE_CONTAINER_PLANE_RED)) {
+      progress->plane = IMAGE_CONTAINER_PLANE_RED;
+    } else {
+      progress->plane = _image_loader_first_plane(progress->planes);
+      progress->row++;
+    }
+  }
+}
+
+/**
+ * Reads at most `length` bytes without crossing a `chunk` boundary of the file,
+ * so reads stay sector aligned, nor the end of the image data.
+ */
+static uint32_t _image_loader_read(image_loader_source_t *source,
+                                   uint8_t *buffer, uint32_t length,
+                                   uint32_t chunk) {
+  const uint32_t boundary = chunk - (source->offset % chunk);
+  length = length < boundary ? length : boundary;
+  length = length < source->left ? length : source->left;
+  if (!length) {
+    return 0;
+  }
+
+  const uint32_t read = fread(buffer, 1, length, source->file);
+  source->offset += read;
+  if (source->left != IMAGE_LOADER_UNBOUNDED) {
+    source->crc = image_container_crc32(source->crc, buffer, read);
+    source->left -= read;
+  }
+  return read;
+}
+
+static uint8_t _image_loader_read_raw(image_loader_source_t *source,
+                                      image_loader_progress_t *progress) {
+  uint32_t length;
+
+  // The file bytes already are plane bytes, each chunk lands in place.
+  while (progress->contiguous && !_image_loader_done(progress)) {
+    uint8_t *target = _image_loader_target(progress, &length);
+    length = length < IMAGE_LOADER_CHUNK_SIZE ? length : IMAGE_LOADER_CHUNK_SIZE;
+    const uint32_t read =
+        _image_loader_read(source, target, length, IMAGE_LOADER_CHUNK_SIZE);
+    _image_loader_advance(progress, read);
+    _image_loader_report(progress, progress->y + progress->row);
+    if (!read) {
+      return ESP_OK;
+    }
+  }
+  if (_image_loader_done(progress)) {
+    return ESP_OK;
+  }
+
+  // Rows are split across planes or narrower than the frame, reading each
+  // segment on its own would cost a card access per row. Whole chunks go to a
+  // staging buffer and are copied out row by row.
+  uint8_t *staging = heap_caps_malloc(IMAGE_LOADER_CHUNK_SIZE, MALLOC_CAP_DMA);
+  if (!staging) {
+    ESP_LOGE(TAG, "Not enough memory to read the image");
+    return ESP_FAIL;
+  }
+
+  while (!_image_loader_done(progress)) {
+    const uint32_t read = _image_loader_read(
+        source, staging, IMAGE_LOADER_CHUNK_SIZE, IMAGE_LOADER_CHUNK_SIZE);
+    if (!read) {
+      break;
+    }
+
+    for (uint32_t offset = 0; offset < read && !_image_loader_done(progress);) {
+      uint8_t *target = _image_loader_target(progress, &length);
+      length = length < (read - offset) ? length : (read - offset);
+      memcpy(target, &staging[offset], length);
+      offset += length;
+      _image_loader_advance(progress, length);
+    }
+    _image_loader_report(progress, progress->y + progress->row);
+  }
+
+  heap_caps_free(staging);
+  return ESP_OK;
+}
+
+static uint8_t _image_loader_read_compressed(
+    image_loader_source_t *source, image_decoder_type_e type,
+    image_loader_progress_t *progress) {
+  image_loader_stream_t *stream =
+      heap_caps_malloc(sizeof(image_loader_stream_t), MALLOC_CAP_DMA);
+  if (!stream) {
+    ESP_LOGE(TAG, "Not enough memory to decode");
+    return ESP_FAIL;
+  }
+  image_decoder_init(&stream->decoder, type);
+
+  uint32_t length;
+  while (!_image_loader_done(progress)) {
+    const uint32_t read =
+        _image_loader_read(source, stream->input, sizeof(stream->input),
+                           IMAGE_LOADER_INPUT_SIZE);
+    if (!read) {
+      // Runs and back-references may still be pending.
+      uint32_t used;
+      uint32_t produced;
+      do {
+        uint8_t *target = _image_loader_target(progress, &length);
+        produced = image_decoder_run(&stream->decoder, NULL, 0, &used, target,
+                                     length);
+        _image_loader_advance(progress, produced);
+      } while (produced && !_image_loader_done(progress));
+      break;
+    }
+
+    // Decoded bytes go straight to the plane, the chunk is the only copy of
+    // the compressed data.
+    uint32_t offset = 0;
+    while (offset < read && !_image_loader_done(progress)) {
+      uint32_t used;
+      uint8_t *target = _image_loader_target(progress, &length);
+      const uint32_t produced = image_decoder_run(
+          &stream->decoder, &stream->input[offset], read - offset, &used,
+          target, length);
+      offset += used;
+      _image_loader_advance(progress, produced);
+    }
+    _image_loader_report(progress, progress->y + progress->row);
+  }
+
+  // Whatever follows the image still counts for the CRC.
+  while (source->left != IMAGE_LOADER_UNBOUNDED &&
+         _image_loader_read(source, stream->input, sizeof(stream->input),
+                            IMAGE_LOADER_INPUT_SIZE)) {
+  }
+
+  heap_caps_free(stream);
+  return ESP_OK;
+}
+
+/**
+ * Reads and checks the container header, the source then covers the data.
+ */
+static uint8_t _image_loader_read_header(
+    image_loader_source_t *source,
+    const graphics_frame_buffer_t *frame_buffer,
+    image_container_header_t *header) {
+  uint8_t raw[IMAGE_CONTAINER_HEADER_SIZE];
+  if (fread(raw, 1, sizeof(raw), source->file) != sizeof(raw)) {
+    ESP_LOGE(TAG, "Container header is truncated");
+    return ESP_FAIL;
+  } else if (image_container_parse_header(raw, frame_buffer->width,
+                                          frame_buffer->height, header)) {
+    return ESP_FAIL;
+  }
+
+  // The CRC covers the header up to itself.
+  source->crc = image_container_crc32(0, raw, IMAGE_CONTAINER_HEADER_SIZE - 4);
+  source->offset = sizeof(raw);
+  source->left = header->data_size;
+  return ESP_OK;
+}
+
+static uint8_t _image_loader_fits(const char *path,
+                                  image_loader_format_e format,
+                                  const graphics_frame_buffer_t *frame_buffer) {
+  if (graphics_frame_buffer_get_stride(frame_buffer) !=
+          BIT_CAPACITY(frame_buffer->width) ||
+      frame_buffer->origin_x || frame_buffer->origin_y) {
+    ESP_LOGE(TAG, "Images can't be loaded into a frame buffer view");
+    return 0;
+  } else if (format == IMAGE_LOADER_FORMAT_UNKNOWN) {
+    ESP_LOGE(TAG, "Unknown format of %s", path);
+    return 0;
+  }
+  return 1;
+}
+
+/** Public functions */
+
+image_loader_format_e image_loader_format_from_path(const char *path) {
+  const char *dot = strrchr(path, '.');
+  if (!dot) {
+    return IMAGE_LOADER_FORMAT_UNKNOWN;
+  } else if (!strcasecmp(dot, ".bin")) {
+    return IMAGE_LOADER_FORMAT_BIN;
+  } else if (!strcasecmp(dot, ".rle")) {
+    return IMAGE_LOADER_FORMAT_RLE;
+  } else if (!strcasecmp(dot, ".lz")) {
+    return IMAGE_LOADER_FORMAT_LZ;
+  } else if (!strcasecmp(dot, ".epi")) {
+    return IMAGE_LOADER_FORMAT_CONTAINER;
+  }
+  return IMAGE_LOADER_FORMAT_UNKNOWN;
+}
+
+uint8_t image_loader_probe(const char *path, image_loader_format_e format,
+                           const graphics_frame_buffer_t *frame_buffer,
+                           uint8_t *planes) {
+  if (!_image_loader_fits(path, format, frame_buffer)) {
+    return ESP_FAIL;
+  } else if (format != IMAGE_LOADER_FORMAT_CONTAINER) {
+    *planes = IMAGE_CONTAINER_PLANE_BW;
+    return ESP_OK;
+  }
+
+  image_loader_source_t source = {.file = fopen(path, "rb")};
+  if (!source.file) {
+    ESP_LOGE(TAG, "Image in %s not found", path);
+    return ESP_FAIL;
+  }
+  image_container_header_t header;
+  const uint8_t err = _image_loader_read_header(&source, frame_buffer, &header);
+  fclose(source.file);
+  if (err) {
+    ESP_LOGE(TAG, "%s is not a valid image", path);
+    return ESP_FAIL;
+  }
+  *planes = header.planes;
+  return ESP_OK;
+}
+
+uint8_t image_loader_load(const char *path, image_loader_format_e format,
+                          graphics_frame_buffer_t *frame_buffer, uint16_t y,
+                          image_loader_rows_cb_t on_rows, void *arg) {
+  if (!_image_loader_fits(path, format, frame_buffer)) {
+    return ESP_FAIL;
+  }
+
+  image_loader_source_t source = {
+      .file = fopen(path, "rb"),
+      .left = IMAGE_LOADER_UNBOUNDED,
+  };
+  if (!source.file) {
+    ESP_LOGE(TAG, "Image in %s not found", path);
+    return ESP_FAIL;
+  }
+  // Every read is a sector aligned chunk going straight to the planes, a
+  // staging buffer or the decoder input, the stdio buffer would only copy it.
+  setvbuf(source.file, NULL, _IONBF, 0);
+
+  const uint16_t stride = BIT_CAPACITY(frame_buffer->width);
+  image_container_header_t header = {
+      .planes = IMAGE_CONTAINER_PLANE_BW,
+      .compression = format == IMAGE_LOADER_FORMAT_BIN
+                         ? IMAGE_CONTAINER_COMPRESSION_NONE
+                     : format == IMAGE_LOADER_FORMAT_LZ
+                         ? IMAGE_CONTAINER_COMPRESSION_LZ
+                         : IMAGE_CONTAINER_COMPRESSION_PACKBITS,
+      .width = frame_buffer->width,
+      .y = y < frame_buffer->height ? y : frame_buffer->height,
+  };
+  header.height = frame_buffer->height - header.y;
+  if (format == IMAGE_LOADER_FORMAT_CONTAINER &&
+      _image_loader_read_header(&source, frame_buffer, &header)) {
+    ESP_LOGE(TAG, "%s is not a valid image", path);
+    fclose(source.file);
+    return ESP_FAIL;
+  }
+
+  image_loader_progress_t progress = {
+      .frame_buffer = frame_buffer,
+      .stride = stride,
+      .x_byte = header.x / 8,
+      .y = header.y,
+      .height = header.height,
+      .row_bytes = BIT_CAPACITY(header.width),
+      .planes = header.planes,
+      .pad_mask = (header.width % 8) ? (0xFF >> (header.width % 8)) : 0x00,
+      .plane = _image_loader_first_plane(header.planes),
+      .on_rows = on_rows,
+      .arg = arg,
+  };
+  progress.contiguous = header.planes == IMAGE_CONTAINER_PLANE_BW &&
+                        progress.row_bytes == stride;
+  _image_loader_prepare(&progress);
+  _image_loader_report(&progress, progress.y);
+
+  uint8_t err = ESP_OK;
+  if (header.compression == IMAGE_CONTAINER_COMPRESSION_NONE) {
+    err = _image_loader_read_raw(&source, &progress);
+  } else {
+    err = _image_loader_read_compressed(
+        &source,
+        header.compression == IMAGE_CONTAINER_COMPRESSION_LZ
+            ? IMAGE_DECODER_LZ
+            : IMAGE_DECODER_PACKBITS,
+        &progress);
+  }
+  fclose(source.file);
+  if (err) {
+    return err;
+  }
+
+  if (format == IMAGE_LOADER_FORMAT_CONTAINER) {
+    // Nothing is shown from a container that isn't exactly what was written.
+    if (!_image_loader_done(&progress) || source.left) {
+      ESP_LOGE(TAG, "%s is truncated", path);
+      return ESP_FAIL;
+    } else if (source.crc != header.crc) {
+      ESP_LOGE(TAG, "%s is corrupted, CRC 0x%08X expected 0x%08X", path,
+               (unsigned)source.crc, (unsigned)header.crc);
+      return ESP_FAIL;
+    }
+  } else if (!_image_loader_done(&progress)) {
+    ESP_LOGW(TAG, "%s is shorter than the frame, padding with white", path);
+    while (!_image_loader_done(&progress)) {
+      uint32_t length;
+      uint8_t *target = _image_loader_target(&progress, &length);
+      memset(target, 0xFF, length);
+      _image_loader_advance(&progress, length);
+    }
+  }
+  _image_loader_report(&progress, frame_buffer->height);
+  return ESP_OK;
+}
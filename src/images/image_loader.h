@@ -0,0 +1,97 @@
+/**
+ * @file image_loader.h
+ * @author jdanypa@gmail.com (Elemeants)
+ * @brief Loads images from the SD card straight into the planes of a frame buffer.
+ *
+ * The file is read in `IMAGE_LOADER_CHUNK_SIZE` chunks directly into the plane storage, there is no stdio
+ * buffer and no per-pixel drawing. Uncompressed containers whose rows don't run contiguously through the frame
+ * (with a red plane, narrower than the frame) go through one chunk sized staging buffer instead, so the card is
+ * still read a chunk at a time. The BIN format (See README) is 1bpp MSB-first with a
+ * set bit for white, the same layout and polarity as `graphics_frame_buffer_t#bw_plane`, so its bytes are
+ * stored as they are read.
+ *
+ * The compressed formats hold the same bytes, they are read `IMAGE_LOADER_INPUT_SIZE` bytes at a time and
+ * decoded straight into the plane (See `image_decoder.h`).
+ *
+ * Containers (See `image_container.h`) carry their own size, placement and planes. Their data is read
+ * exactly as the header sizes it and checked against its CRC while it streams, an image smaller than the
+ * screen is stored without padding and the absent planes are skipped.
+ *
+ * Rows are reported through a callback as soon as they are final, so they can be uploaded while the rest
+ * of the file is still being read (See `graphics_renderer_stream_rows`).
+ */
+#pragma once
+
+#include "image_container.h"
+#include "screen/frame.h"
+
+/**
+ * @brief Number of bytes read from the file at once, a multiple of the 512 bytes SD sector so every read
+ * starts on a sector boundary and goes straight to the destination.
+ */
+#define IMAGE_LOADER_CHUNK_SIZE 4096
+
+/**
+ * @brief Number of compressed bytes read at once, one SD sector.
+ */
+#define IMAGE_LOADER_INPUT_SIZE 512
+
+/**
+ * @brief Format of an image file, given by its extension.
+ */
+typedef enum {
+  IMAGE_LOADER_FORMAT_BIN,        // .bin, raw B/W plane
+  IMAGE_LOADER_FORMAT_RLE,        // .rle, PackBits compressed B/W plane
+  IMAGE_LOADER_FORMAT_LZ,         // .lz, LZSS (heatshrink) compressed B/W plane
+  IMAGE_LOADER_FORMAT_CONTAINER,  // .epi, tri-color container with header and CRC
+  IMAGE_LOADER_FORMAT_UNKNOWN,
+} image_loader_format_e;
+
+/**
+ * @brief Called with every band of rows that won't be written again, top to bottom.
+ *
+ * @param y First row of the band.
+ * @param height Number of rows in the band.
+ * @param arg The argument given to `image_loader_load`.
+ */
+typedef void (*image_loader_rows_cb_t)(uint16_t y, uint16_t height, void *arg);
+
+/**
+ * @brief Finds the format of an image file from its extension, case insensitive.
+ *
+ * @param path Path or name of the file.
+ * @return image_loader_format_e The format, `IMAGE_LOADER_FORMAT_UNKNOWN` for files that aren't images.
+ */
+image_loader_format_e image_loader_format_from_path(const char *path);
+
+/**
+ * @brief Checks that an image can be loaded into a frame buffer and tells which planes it holds, only
+ * containers are opened.
+ *
+ * @param path Path of the file.
+ * @param format Format of the file (See `image_loader_format_from_path`).
+ * @param frame_buffer Frame buffer the image would be loaded into.
+ * @param planes Planes stored in the file (`IMAGE_CONTAINER_PLANE_BW`, `IMAGE_CONTAINER_PLANE_RED`).
+ * @return uint8_t ESP_OK for a loadable image, ESP_FAIL if the file can't be opened or its header is invalid.
+ */
+uint8_t image_loader_probe(const char *path, image_loader_format_e format,
+                           const graphics_frame_buffer_t *frame_buffer, uint8_t *planes);
+
+/**
+ * @brief Loads an image into the whole frame buffer.
+ *
+ * Everything outside the image is white. Files without header are a B/W plane as wide as the frame placed
+ * `y` rows down, when shorter than the space left they are padded with white, longer ones are cut.
+ *
+ * @param path Path of the file to load.
+ * @param format Format of the file (See `image_loader_format_from_path`).
+ * @param frame_buffer Frame buffer to fill, must not be a view.
+ * @param y Row where files without header start, containers carry their own placement.
+ * @param on_rows Called with every band of finished rows, can be NULL (See `image_loader_rows_cb_t`).
+ * @param arg Argument passed to `on_rows`.
+ * @return uint8_t ESP_OK once the whole frame was written, ESP_FAIL if the file can't be opened or decoded,
+ * or is a truncated or corrupted container. On failure the frame buffer content is undefined and the rows
+ * left are not reported.
+ */
+uint8_t image_loader_load(const char *path, image_loader_format_e format, graphics_frame_buffer_t *frame_buffer,
+                          uint16_t y, image_loader_rows_cb_t on_rows, void *arg);
@@ -24,7 +24,7 @@ static const e_paper_hub_peripherals_config_t global_device_configs = {
     .width = SCREEN_WIDTH,
     .spi_clk_pin = GPIO_NUM_19,
     .spi_mosi_pin = GPIO_NUM_23,
-    .spi_miso_pin = GPIO_NUM_25,
+    .spi_miso_pin = GPIO_NUM_NC,
     .spi_cs_pin = GPIO_NUM_22,
     .gpio_busy_pin = GPIO_NUM_25,
     .gpio_rst_pin = GPIO_NUM_26,
@@ -52,6 +52,6 @@ void app_main() {
 
   while (1) {
     hub_render_next_image();
-    sleep_ms(10000);
+    sleep_ms(HUB_RENDER_INTERVAL_MS);
   }
 }
@@ -6,14 +6,24 @@
 
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <esp_log.h>
 
 #include "fonts/fonts.h"
 #include "utils/timing.h"
 
-#define HORIZONTAL 0
-#define VERTICAL 1
+/** Private types */
+
+/**
+ * Clip rectangle as exclusive `[x0, x1) x [y0, y1)` bounds.
+ */
+typedef struct {
+  int32_t x0;
+  int32_t y0;
+  int32_t x1;
+  int32_t y1;
+} graphics_clip_bounds_t;
 
 /** Private variables */
 
@@ -21,50 +31,423 @@ static const char* TAG = "frame";
 
 /** Private functions */
 
-static inline int16_t _math_calculate_slope_distances(uint16_t dx,
-                                                      uint16_t dy) {
-  dx = dx == 0 ? 1 : dx;  // Prevent division by zero
-  dy = dy == 0 ? 1 : dy;  // Prevent division by zero
-  return dy / dx;
+static inline uint16_t _graphics_frame_buffer_stride(
+    const graphics_frame_buffer_t *frame_buffer) {
+  return frame_buffer->stride ? frame_buffer->stride
+                              : BIT_CAPACITY(frame_buffer->width);
 }
 
-static inline int16_t _math_calculate_slope_points(uint16_t x1, uint16_t y1,
-                                                   uint16_t x2, uint16_t y2) {
-  int16_t dx = abs(x2 - x1);
-  int16_t dy = abs(y2 - y1);
-  return _math_calculate_slope_distances(dx, dy);
+/**
+ * Returns the plane offset of the first byte of the view row `y`.
+ */
+static inline uint32_t _graphics_frame_buffer_row_offset(
+    const graphics_frame_buffer_t *frame_buffer, uint16_t stride, int32_t y) {
+  return (uint32_t)(frame_buffer->origin_y + y) * stride;
 }
 
-static inline uint8_t _ensure_bounds(uint16_t x1, uint16_t y1, uint16_t x2,
-                                     uint16_t y2, uint16_t width,
-                                     uint16_t height) {
-  if (x1 > width || y1 > height || x2 > width || y2 > height) {
-    return 0;  // Out of bounds
+static inline graphics_clip_bounds_t _graphics_frame_buffer_clip_bounds(
+    const graphics_frame_buffer_t *frame_buffer) {
+  graphics_clip_bounds_t bounds = {0, 0, frame_buffer->width,
+                                   frame_buffer->height};
+  if (frame_buffer->clip_depth) {
+    const graphics_rect_t *clip =
+        &frame_buffer->clip_stack[frame_buffer->clip_depth - 1];
+    bounds.x0 = clip->x;
+    bounds.y0 = clip->y;
+    bounds.x1 = clip->x + clip->width;
+    bounds.y1 = clip->y + clip->height;
   }
-  return 1;  // Within bounds
+  return bounds;
 }
 
-static inline void _graphics_frame_buffer_draw_bitmap(
-    graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y,
-    const uint8_t *data, uint16_t width, uint16_t height,
-    graphics_color_e color, int invert) {
-  for (uint16_t row = 0; row < height; row++) {
-    for (uint16_t col = 0; col < width; col++) {
-      const uint32_t col_font_idx = (col / 8);
-      const uint16_t byte_index = (row * BIT_CAPACITY(width)) + col_font_idx;
-      uint8_t font_bitmask = data[byte_index];
-      if (invert) {
-        font_bitmask = ~font_bitmask;
+static inline uint32_t _rect_area(const graphics_rect_t *rect) {
+  return (uint32_t)rect->width * rect->height;
+}
+
+static inline graphics_rect_t _rect_union(const graphics_rect_t *a,
+                                          const graphics_rect_t *b) {
+  const uint16_t x0 = a->x < b->x ? a->x : b->x;
+  const uint16_t y0 = a->y < b->y ? a->y : b->y;
+  const uint32_t a_x1 = a->x + a->width, b_x1 = b->x + b->width;
+  const uint32_t a_y1 = a->y + a->height, b_y1 = b->y + b->height;
+  const graphics_rect_t result = {
+      .x = x0,
+      .y = y0,
+      .width = (a_x1 > b_x1 ? a_x1 : b_x1) - x0,
+      .height = (a_y1 > b_y1 ? a_y1 : b_y1) - y0,
+  };
+  return result;
+}
+
+static inline uint32_t _rect_intersection_area(const graphics_rect_t *a,
+                                               const graphics_rect_t *b) {
+  const int32_t x0 = a->x > b->x ? a->x : b->x;
+  const int32_t y0 = a->y > b->y ? a->y : b->y;
+  const int32_t a_x1 = a->x + a->width, b_x1 = b->x + b->width;
+  const int32_t a_y1 = a->y + a->height, b_y1 = b->y + b->height;
+  const int32_t x1 = a_x1 < b_x1 ? a_x1 : b_x1;
+  const int32_t y1 = a_y1 < b_y1 ? a_y1 : b_y1;
+  return (x1 > x0 && y1 > y0) ? (uint32_t)(x1 - x0) * (y1 - y0) : 0;
+}
+
+/**
+ * Area of the union of `a` and `b` that isn't covered by any of them.
+ */
+static inline uint32_t _rect_merge_waste(const graphics_rect_t *a,
+                                         const graphics_rect_t *b,
+                                         uint32_t *union_area) {
+  const graphics_rect_t merged = _rect_union(a, b);
+  const uint32_t covered =
+      _rect_area(a) + _rect_area(b) - _rect_intersection_area(a, b);
+  *union_area = _rect_area(&merged);
+  return *union_area - covered;
+}
+
+static void _graphics_dirty_list_remove(graphics_dirty_list_t *dirty_list,
+                                        uint8_t idx) {
+  dirty_list->count--;
+  dirty_list->rects[idx] = dirty_list->rects[dirty_list->count];
+}
+
+/**
+ * Merges `rect` into the list entry with the least waste if it's under the
+ * threshold (or unconditionally when `force`), and keeps merging the result
+ * with the remaining entries while it keeps paying off.
+ */
+static uint8_t _graphics_dirty_list_merge(graphics_dirty_list_t *dirty_list,
+                                          graphics_rect_t rect, uint8_t force) {
+  uint8_t merged = 0;
+
+  while (dirty_list->count) {
+    uint8_t best_idx = 0;
+    uint32_t best_waste = UINT32_MAX;
+    uint32_t best_union_area = 0;
+    for (uint8_t idx = 0; idx < dirty_list->count; idx++) {
+      uint32_t union_area;
+      const uint32_t waste =
+          _rect_merge_waste(&dirty_list->rects[idx], &rect, &union_area);
+      if (waste < best_waste) {
+        best_idx = idx;
+        best_waste = waste;
+        best_union_area = union_area;
       }
+    }
+
+    const uint8_t pays_off = (uint64_t)best_waste * 100 <=
+                             (uint64_t)dirty_list->merge_waste_percent *
+                                 best_union_area;
+    if (!pays_off && !(force && !merged)) {
+      break;
+    }
+
+    rect = _rect_union(&dirty_list->rects[best_idx], &rect);
+    _graphics_dirty_list_remove(dirty_list, best_idx);
+    merged = 1;
+  }
+
+  if (merged) {
+    dirty_list->rects[dirty_list->count++] = rect;
+  }
+  return merged;
+}
+
+/**
+ * Reports the `[x0, x1) x [y0, y1)` view area as touched, after clipping it.
+ */
+static void _graphics_frame_buffer_mark_dirty(
+    const graphics_frame_buffer_t *frame_buffer, int32_t x0, int32_t y0,
+    int32_t x1, int32_t y1) {
+  if (!frame_buffer->dirty) {
+    return;
+  }
+
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  x0 = x0 < clip.x0 ? clip.x0 : x0;
+  y0 = y0 < clip.y0 ? clip.y0 : y0;
+  x1 = x1 < clip.x1 ? x1 : clip.x1;
+  y1 = y1 < clip.y1 ? y1 : clip.y1;
+  if (x0 >= x1 || y0 >= y1) {
+    return;  // Nothing was drawn
+  }
+
+  graphics_dirty_list_add(frame_buffer->dirty, frame_buffer->origin_x + x0,
+                          frame_buffer->origin_y + y0, x1 - x0, y1 - y0);
+}
+
+static inline uint8_t _color_bw_fill(graphics_color_e color) {
+  return color == GRAPHICS_COLOR_WHITE ? 0xFF : 0x00;
+}
+
+static inline uint8_t _color_red_fill(graphics_color_e color) {
+  return color == GRAPHICS_COLOR_RED ? 0xFF : 0x00;
+}
+
+static inline void _plane_write_masked(uint8_t *plane_byte, uint8_t mask,
+                                       uint8_t fill) {
+  *plane_byte = (*plane_byte & ~mask) | (fill & mask);
+}
+
+/**
+ * Paints the `[x0, x1)` span of one row: masked head and tail bytes, and a
+ * plain memset for the whole bytes in between.
+ */
+static void _graphics_frame_buffer_fill_span(uint8_t *bw_row, uint8_t *red_row,
+                                             uint16_t x0, uint16_t x1,
+                                             uint8_t bw_fill,
+                                             uint8_t red_fill) {
+  uint16_t head_idx = x0 >> 3;
+  const uint16_t tail_idx = (x1 - 1) >> 3;
+  uint8_t head_mask = 0xFF >> (x0 & 7);
+  const uint8_t tail_mask = 0xFF << ((8 - (x1 & 7)) & 7);
+
+  if (head_idx == tail_idx) {
+    head_mask &= tail_mask;
+    _plane_write_masked(&bw_row[head_idx], head_mask, bw_fill);
+    _plane_write_masked(&red_row[head_idx], head_mask, red_fill);
+    return;
+  }
+
+  if (head_mask != 0xFF) {
+    _plane_write_masked(&bw_row[head_idx], head_mask, bw_fill);
+    _plane_write_masked(&red_row[head_idx], head_mask, red_fill);
+    head_idx++;
+  }
+
+  if (tail_mask != 0xFF) {
+    _plane_write_masked(&bw_row[tail_idx], tail_mask, bw_fill);
+    _plane_write_masked(&red_row[tail_idx], tail_mask, red_fill);
+  }
+
+  const uint16_t end_idx = tail_mask == 0xFF ? tail_idx + 1 : tail_idx;
+  if (end_idx > head_idx) {
+    memset(&bw_row[head_idx], bw_fill, end_idx - head_idx);
+    memset(&red_row[head_idx], red_fill, end_idx - head_idx);
+  }
+}
+
+/**
+ * Paints the `[y0, y1)` column span at `x`, one masked byte per row.
+ */
+static void _graphics_frame_buffer_fill_column(
+    graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y0,
+    uint16_t y1, uint8_t bw_fill, uint8_t red_fill) {
+  const uint16_t stride = _graphics_frame_buffer_stride(frame_buffer);
+  const uint16_t plane_x = frame_buffer->origin_x + x;
+  const uint8_t bit_mask = 0x80 >> (plane_x & 7);
+  uint32_t offset =
+      _graphics_frame_buffer_row_offset(frame_buffer, stride, y0) +
+      (plane_x >> 3);
+
+  for (uint16_t row = y0; row < y1; row++, offset += stride) {
+    _plane_write_masked(&frame_buffer->bw_plane[offset], bit_mask, bw_fill);
+    _plane_write_masked(&frame_buffer->red_plane[offset], bit_mask, red_fill);
+  }
+}
+
+/**
+ * Paints the inclusive `[x0, x1]` span of row `y`, clipped to the clip rect.
+ */
+static void _graphics_frame_buffer_fill_hspan(
+    graphics_frame_buffer_t *frame_buffer, int32_t x0, int32_t x1, int32_t y,
+    uint8_t bw_fill, uint8_t red_fill) {
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  if (y < clip.y0 || y >= clip.y1 || x1 < clip.x0 || x0 >= clip.x1 ||
+      x1 < x0) {
+    return;  // Out of bounds
+  }
+
+  const uint16_t start = x0 < clip.x0 ? clip.x0 : x0;
+  const uint16_t end = x1 < clip.x1 ? (x1 + 1) : clip.x1;
+  const uint32_t offset = _graphics_frame_buffer_row_offset(
+      frame_buffer, _graphics_frame_buffer_stride(frame_buffer), y);
+  _graphics_frame_buffer_fill_span(&frame_buffer->bw_plane[offset],
+                                   &frame_buffer->red_plane[offset],
+                                   frame_buffer->origin_x + start,
+                                   frame_buffer->origin_x + end, bw_fill,
+                                   red_fill);
+}
+
+/**
+ * Writes a single pixel without any bounds check, callers clip beforehand.
+ */
+static inline void _graphics_frame_buffer_put_pixel(
+    graphics_frame_buffer_t *frame_buffer, uint16_t stride, int32_t x,
+    int32_t y, uint8_t bw_fill, uint8_t red_fill) {
+  const uint16_t plane_x = frame_buffer->origin_x + x;
+  const uint32_t offset =
+      _graphics_frame_buffer_row_offset(frame_buffer, stride, y) +
+      (plane_x >> 3);
+  const uint8_t bit_mask = 0x80 >> (plane_x & 7);
+  _plane_write_masked(&frame_buffer->bw_plane[offset], bit_mask, bw_fill);
+  _plane_write_masked(&frame_buffer->red_plane[offset], bit_mask, red_fill);
+}
+
+static inline void _graphics_frame_buffer_plot(
+    graphics_frame_buffer_t *frame_buffer, const graphics_clip_bounds_t *clip,
+    int32_t x, int32_t y, uint8_t bw_fill, uint8_t red_fill) {
+  if (x < clip->x0 || y < clip->y0 || x >= clip->x1 || y >= clip->y1) {
+    return;  // Out of bounds
+  }
+
+  _graphics_frame_buffer_put_pixel(frame_buffer,
+                                   _graphics_frame_buffer_stride(frame_buffer),
+                                   x, y, bw_fill, red_fill);
+}
+
+static void _graphics_frame_buffer_draw_hline(
+    graphics_frame_buffer_t *frame_buffer, uint16_t x0, uint16_t x1,
+    uint16_t y, graphics_color_e color) {
+  _graphics_frame_buffer_fill_hspan(frame_buffer, x0, x1, y,
+                                    _color_bw_fill(color),
+                                    _color_red_fill(color));
+}
+
+static void _graphics_frame_buffer_draw_vline(
+    graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y0,
+    uint16_t y1, graphics_color_e color) {
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  if (x < clip.x0 || x >= clip.x1 || y1 < clip.y0 || y0 >= clip.y1) {
+    return;  // Out of bounds
+  }
+
+  const uint16_t start = y0 < clip.y0 ? clip.y0 : y0;
+  const uint16_t end = y1 < clip.y1 ? (y1 + 1) : clip.y1;
+  _graphics_frame_buffer_fill_column(frame_buffer, x, start, end,
+                                     _color_bw_fill(color),
+                                     _color_red_fill(color));
+}
+
+/**
+ * Returns the 8 source bits that start at bit `bit_pos` of `src_row`.
+ * `bit_pos` may be negative (down to -7) for a destination head byte.
+ */
+static inline uint8_t _bitmap_bits8_at(const uint8_t *src_row,
+                                       uint16_t src_row_bytes,
+                                       int32_t bit_pos) {
+  if (bit_pos < 0) {
+    return src_row[0] >> (-bit_pos);
+  }
+
+  const uint32_t byte_idx = bit_pos >> 3;
+  const uint8_t shift = bit_pos & 7;
+  uint16_t bits = src_row[byte_idx] << 8;
+  if (shift && (byte_idx + 1) < src_row_bytes) {
+    bits |= src_row[byte_idx + 1];
+  }
+  return (uint8_t)((bits << shift) >> 8);
+}
+
+/**
+ * Returns the 32 source bits that start at bit `bit_pos` of `src_row`, the
+ * left-most pixel lands on bit 31. All of them must be inside the row.
+ */
+static inline uint32_t _bitmap_bits32_at(const uint8_t *src_row,
+                                         uint32_t bit_pos) {
+  const uint8_t *src = &src_row[bit_pos >> 3];
+  const uint8_t shift = bit_pos & 7;
+  uint32_t bits = ((uint32_t)src[0] << 24) | ((uint32_t)src[1] << 16) |
+                  ((uint32_t)src[2] << 8) | (uint32_t)src[3];
+  if (shift) {
+    bits = (bits << shift) | (src[4] >> (8 - shift));
+  }
+  return bits;
+}
+
+/**
+ * Blits the `[x0, x1)` destination span of one row from a 1bpp MSB-first
+ * source row, where the source bit `src_bit` lands on `x0`. Only the set
+ * source bits (or cleared ones if `invert`) are painted.
+ *
+ * Destination bytes are merged 32 bits at a time when both planes are word
+ * aligned at that position, otherwise one byte at a time.
+ */
+static void _graphics_frame_buffer_blit_row(uint8_t *bw_row, uint8_t *red_row,
+                                            uint16_t x0, uint16_t x1,
+                                            const uint8_t *src_row,
+                                            uint16_t src_row_bytes,
+                                            uint32_t src_bit, int invert,
+                                            uint8_t bw_fill, uint8_t red_fill) {
+  const uint32_t bw_fill32 = bw_fill ? 0xFFFFFFFF : 0x00000000;
+  const uint32_t red_fill32 = red_fill ? 0xFFFFFFFF : 0x00000000;
+  uint16_t byte_idx = x0 >> 3;
+  const uint16_t last_byte_idx = (x1 - 1) >> 3;
 
-      const uint8_t bit = (font_bitmask & (1 << (7 - (col % 8)))) != 0;
+  while (byte_idx <= last_byte_idx) {
+    const uint32_t byte_x = byte_idx * 8;
+    const int32_t bit_pos = (int32_t)src_bit + (int32_t)byte_x - x0;
 
-      if (!bit) {
-        continue;  // Skip if the pixel is not set
+    if (byte_x >= x0 && byte_x + 32 <= x1 &&
+        (((uintptr_t)&bw_row[byte_idx] | (uintptr_t)&red_row[byte_idx]) & 3) ==
+            0) {
+      uint32_t bits = _bitmap_bits32_at(src_row, bit_pos);
+      if (invert) {
+        bits = ~bits;
+      }
+      if (bits) {
+        // Planes are MSB-first byte streams, swap the mask to memory order.
+        const uint32_t mask = __builtin_bswap32(bits);
+        uint32_t *bw_word = (uint32_t *)&bw_row[byte_idx];
+        uint32_t *red_word = (uint32_t *)&red_row[byte_idx];
+        *bw_word = (*bw_word & ~mask) | (bw_fill32 & mask);
+        *red_word = (*red_word & ~mask) | (red_fill32 & mask);
       }
+      byte_idx += 4;
+      continue;
+    }
 
-      graphics_frame_buffer_draw_pixel(frame_buffer, x + col, y + row, color);
+    uint8_t mask = 0xFF;
+    if (byte_x < x0) {
+      mask &= 0xFF >> (x0 - byte_x);
+    }
+    if (byte_x + 8 > x1) {
+      mask &= 0xFF << (byte_x + 8 - x1);
     }
+
+    uint8_t bits = _bitmap_bits8_at(src_row, src_row_bytes, bit_pos);
+    if (invert) {
+      bits = ~bits;
+    }
+    mask &= bits;
+    if (mask) {
+      _plane_write_masked(&bw_row[byte_idx], mask, bw_fill);
+      _plane_write_masked(&red_row[byte_idx], mask, red_fill);
+    }
+    byte_idx++;
+  }
+}
+
+static inline void _graphics_frame_buffer_draw_bitmap(
+    graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y,
+    const uint8_t *data, uint16_t width, uint16_t height,
+    graphics_color_e color, int invert) {
+  // Clip once, every row is then blitted without per-pixel checks.
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  const int32_t x0 = x < clip.x0 ? clip.x0 : x;
+  const int32_t y0 = y < clip.y0 ? clip.y0 : y;
+  const int32_t x1 = ((int32_t)x + width) < clip.x1 ? (x + width) : clip.x1;
+  const int32_t y1 = ((int32_t)y + height) < clip.y1 ? (y + height) : clip.y1;
+  if (x0 >= x1 || y0 >= y1) {
+    return;  // Nothing to draw
+  }
+  _graphics_frame_buffer_mark_dirty(frame_buffer, x0, y0, x1, y1);
+
+  const uint16_t stride = _graphics_frame_buffer_stride(frame_buffer);
+  const uint16_t src_row_bytes = BIT_CAPACITY(width);
+  const uint8_t bw_fill = _color_bw_fill(color);
+  const uint8_t red_fill = _color_red_fill(color);
+
+  for (int32_t row = y0; row < y1; row++) {
+    const uint32_t offset =
+        _graphics_frame_buffer_row_offset(frame_buffer, stride, row);
+    _graphics_frame_buffer_blit_row(
+        &frame_buffer->bw_plane[offset], &frame_buffer->red_plane[offset],
+        frame_buffer->origin_x + x0, frame_buffer->origin_x + x1,
+        &data[(row - y) * src_row_bytes], src_row_bytes, x0 - x, invert,
+        bw_fill, red_fill);
   }
 }
 
@@ -76,67 +459,270 @@ static inline void _graphics_frame_buffer_draw_bitmap(
 
 //   frame_buffer.width = width;
 //   frame_buffer.height = height;
-//   ESP_LOGI(TAG, "Allocating frame_buffer for (%d, %d) = %d (av = %d)", width, height,
-//            width * height, heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
-//   frame_buffer.buffer = (uint8_t *)malloc(width * height);
-//   if (frame_buffer.buffer == NULL) {
+//   const uint32_t plane_size = GRAPHICS_FRAME_BUFFER_PLANE_SIZE(width, height);
+//   ESP_LOGI(TAG, "Allocating frame_buffer for (%d, %d) = 2x%d (av = %d)", width, height,
+//            plane_size, heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+//   frame_buffer.bw_plane = (uint8_t *)malloc(plane_size);
+//   frame_buffer.red_plane = (uint8_t *)malloc(plane_size);
+//   if (frame_buffer.bw_plane == NULL || frame_buffer.red_plane == NULL) {
 //     ESP_LOGE(TAG,
-//              "Critical error: frame_buffer can't be allocated av=%d, try=%d",
+//              "Critical error: frame_buffer can't be allocated av=%d, try=2x%d",
 //              heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT),
-//              width * height);
+//              plane_size);
 //     return frame_buffer;
 //   }
 
-//   memset(frame_buffer.buffer, 0, width * height);
+//   memset(frame_buffer.bw_plane, 0xFF, plane_size);
+//   memset(frame_buffer.red_plane, 0x00, plane_size);
 
 //   return frame_buffer;
 // }
 
 void graphics_frame_buffer_destroy(graphics_frame_buffer_t *frame_buffer) {
-  if (frame_buffer->buffer) {
-    free(frame_buffer->buffer);
-    frame_buffer->buffer = NULL;
+  if (frame_buffer->bw_plane) {
+    free(frame_buffer->bw_plane);
+    frame_buffer->bw_plane = NULL;
+  }
+
+  if (frame_buffer->red_plane) {
+    free(frame_buffer->red_plane);
+    frame_buffer->red_plane = NULL;
   }
 
   frame_buffer->width = 0;
   frame_buffer->height = 0;
+  frame_buffer->clip_depth = 0;
+}
+
+uint8_t graphics_frame_buffer_push_clip(graphics_frame_buffer_t *frame_buffer,
+                                        uint16_t x, uint16_t y, uint16_t width,
+                                        uint16_t height) {
+  if (frame_buffer->clip_depth >= GRAPHICS_FRAME_BUFFER_CLIP_DEPTH) {
+    ESP_LOGW(TAG, "Clip stack is full, ignoring push");
+    return 0;
+  }
+
+  // Intersect with the current clip so the stack entries are always nested.
+  const graphics_clip_bounds_t parent =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  int32_t x0 = x > parent.x0 ? x : parent.x0;
+  int32_t y0 = y > parent.y0 ? y : parent.y0;
+  int32_t x1 = ((int32_t)x + width) < parent.x1 ? (x + width) : parent.x1;
+  int32_t y1 = ((int32_t)y + height) < parent.y1 ? (y + height) : parent.y1;
+  if (x0 >= x1 || y0 >= y1) {
+    x0 = x1 = parent.x0;  // Empty clip, nothing will be drawn
+    y0 = y1 = parent.y0;
+  }
+
+  graphics_rect_t *clip = &frame_buffer->clip_stack[frame_buffer->clip_depth];
+  clip->x = x0;
+  clip->y = y0;
+  clip->width = x1 - x0;
+  clip->height = y1 - y0;
+  frame_buffer->clip_depth++;
+  return 1;
+}
+
+void graphics_frame_buffer_pop_clip(graphics_frame_buffer_t *frame_buffer) {
+  if (frame_buffer->clip_depth) {
+    frame_buffer->clip_depth--;
+  }
+}
+
+graphics_rect_t graphics_frame_buffer_get_clip(
+    const graphics_frame_buffer_t *frame_buffer) {
+  const graphics_clip_bounds_t bounds =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  const graphics_rect_t clip = {
+      .x = bounds.x0,
+      .y = bounds.y0,
+      .width = bounds.x1 - bounds.x0,
+      .height = bounds.y1 - bounds.y0,
+  };
+  return clip;
+}
+
+void graphics_dirty_list_init(graphics_dirty_list_t *dirty_list,
+                              uint8_t merge_waste_percent) {
+  memset(dirty_list, 0x00, sizeof(graphics_dirty_list_t));
+  dirty_list->merge_waste_percent = merge_waste_percent;
+}
+
+void graphics_dirty_list_reset(graphics_dirty_list_t *dirty_list) {
+  dirty_list->count = 0;
+}
+
+void graphics_dirty_list_add(graphics_dirty_list_t *dirty_list, uint16_t x,
+                             uint16_t y, uint16_t width, uint16_t height) {
+  if (!width || !height) {
+    return;
+  }
+
+  const graphics_rect_t rect = {
+      .x = x, .y = y, .width = width, .height = height};
+  if (_graphics_dirty_list_merge(dirty_list, rect, 0)) {
+    return;
+  }
+
+  if (dirty_list->count < GRAPHICS_DIRTY_LIST_SIZE) {
+    dirty_list->rects[dirty_list->count++] = rect;
+    return;
+  }
+
+  // The list is full, fold the new rectangle into the cheapest entry.
+  _graphics_dirty_list_merge(dirty_list, rect, 1);
+}
+
+graphics_rect_t graphics_dirty_list_bounds(
+    const graphics_dirty_list_t *dirty_list) {
+  graphics_rect_t bounds = {0};
+  for (uint8_t idx = 0; idx < dirty_list->count; idx++) {
+    bounds = idx ? _rect_union(&bounds, &dirty_list->rects[idx])
+                 : dirty_list->rects[idx];
+  }
+  return bounds;
+}
+
+graphics_frame_buffer_t graphics_frame_buffer_view(
+    const graphics_frame_buffer_t *parent, uint16_t x, uint16_t y,
+    uint16_t width, uint16_t height) {
+  graphics_frame_buffer_t view;
+  memset(&view, 0x00, sizeof(view));
+
+  // Views share the parent planes, only the origin and the size change.
+  view.bw_plane = parent->bw_plane;
+  view.red_plane = parent->red_plane;
+  view.stride = _graphics_frame_buffer_stride(parent);
+  view.dirty = parent->dirty;
+  if (x >= parent->width || y >= parent->height) {
+    ESP_LOGW(TAG, "View (%d, %d) is outside of the parent frame", x, y);
+    return view;  // Empty view
+  }
+
+  view.origin_x = parent->origin_x + x;
+  view.origin_y = parent->origin_y + y;
+  view.width = ((uint32_t)x + width) < parent->width ? width : (parent->width - x);
+  view.height =
+      ((uint32_t)y + height) < parent->height ? height : (parent->height - y);
+  return view;
+}
+
+uint16_t graphics_frame_buffer_get_stride(
+    const graphics_frame_buffer_t *frame_buffer) {
+  return _graphics_frame_buffer_stride(frame_buffer);
 }
 
 void graphics_frame_buffer_clear(graphics_frame_buffer_t *frame_buffer,
                                  graphics_color_e color) {
-  memset(frame_buffer->buffer, (uint8_t)color,
-         frame_buffer->width * frame_buffer->height * sizeof(uint8_t));
+  const uint16_t stride = _graphics_frame_buffer_stride(frame_buffer);
+  const uint8_t bw_fill = _color_bw_fill(color);
+  const uint8_t red_fill = _color_red_fill(color);
+
+  if (frame_buffer->dirty) {
+    graphics_dirty_list_add(frame_buffer->dirty, frame_buffer->origin_x,
+                            frame_buffer->origin_y, frame_buffer->width,
+                            frame_buffer->height);
+  }
+
+  // Only a frame covering every bit of its rows owns the whole planes, a
+  // narrower view shares the end of each row with its parent.
+  if (!frame_buffer->origin_x && !frame_buffer->origin_y &&
+      (uint32_t)frame_buffer->width == (uint32_t)stride * 8) {
+    const uint32_t plane_size = stride * frame_buffer->height;
+    memset(frame_buffer->bw_plane, bw_fill, plane_size);
+    memset(frame_buffer->red_plane, red_fill, plane_size);
+    return;
+  }
+
+  // Views only own a window of the planes, clear it row by row.
+  if (!frame_buffer->width) {
+    return;
+  }
+  for (uint16_t row = 0; row < frame_buffer->height; row++) {
+    const uint32_t offset =
+        _graphics_frame_buffer_row_offset(frame_buffer, stride, row);
+    _graphics_frame_buffer_fill_span(
+        &frame_buffer->bw_plane[offset], &frame_buffer->red_plane[offset],
+        frame_buffer->origin_x, frame_buffer->origin_x + frame_buffer->width,
+        bw_fill, red_fill);
+  }
 }
 
 inline void graphics_frame_buffer_draw_pixel(
     graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y,
     graphics_color_e color) {
-  if (x < frame_buffer->width && y < frame_buffer->height) {
-    frame_buffer->buffer[(y * frame_buffer->width) + x] = (uint8_t)color;
-  }
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  _graphics_frame_buffer_plot(frame_buffer, &clip, x, y, _color_bw_fill(color),
+                              _color_red_fill(color));
+  _graphics_frame_buffer_mark_dirty(frame_buffer, x, y, x + 1, y + 1);
 }
 
 void graphics_frame_buffer_draw_line(graphics_frame_buffer_t *frame_buffer,
                                      uint16_t x1, uint16_t y1, uint16_t x2,
                                      uint16_t y2, graphics_color_e color) {
-  if (!_ensure_bounds(x1, y1, x2, y2, frame_buffer->width,
-                      frame_buffer->height)) {
+  const int32_t min_x = x1 < x2 ? x1 : x2;
+  const int32_t max_x = x1 < x2 ? x2 : x1;
+  const int32_t min_y = y1 < y2 ? y1 : y2;
+  const int32_t max_y = y1 < y2 ? y2 : y1;
+  _graphics_frame_buffer_mark_dirty(frame_buffer, min_x, min_y, max_x + 1,
+                                    max_y + 1);
+
+  if (y1 == y2) {
+    _graphics_frame_buffer_draw_hline(frame_buffer, x1 < x2 ? x1 : x2,
+                                      x1 < x2 ? x2 : x1, y1, color);
+    return;
+  }
+
+  if (x1 == x2) {
+    _graphics_frame_buffer_draw_vline(frame_buffer, x1, y1 < y2 ? y1 : y2,
+                                      y1 < y2 ? y2 : y1, color);
+    return;
+  }
+
+  // Integer Bresenham, valid for all octants.
+  const int32_t dx = abs((int32_t)x2 - x1);
+  const int32_t dy = -abs((int32_t)y2 - y1);
+  const int32_t step_x = x1 < x2 ? 1 : -1;
+  const int32_t step_y = y1 < y2 ? 1 : -1;
+  const uint16_t stride = _graphics_frame_buffer_stride(frame_buffer);
+  const uint8_t bw_fill = _color_bw_fill(color);
+  const uint8_t red_fill = _color_red_fill(color);
+
+  // Clip the bounding box once: lines fully inside the clip rectangle run
+  // without per-pixel checks, and lines fully outside are rejected.
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  if (max_x < clip.x0 || min_x >= clip.x1 || max_y < clip.y0 ||
+      min_y >= clip.y1) {
     return;  // Out of bounds
   }
+  const uint8_t inside = (min_x >= clip.x0 && max_x < clip.x1 &&
+                          min_y >= clip.y0 && max_y < clip.y1);
 
-  const int16_t distance_x = abs(x2 - x1);
-  const int16_t distance_y = abs(y2 - y1);
-  const int16_t slope = _math_calculate_slope_distances(distance_x, distance_y);
+  int32_t x = x1;
+  int32_t y = y1;
+  int32_t error = dx + dy;
+  while (1) {
+    if (inside ||
+        (x >= clip.x0 && x < clip.x1 && y >= clip.y0 && y < clip.y1)) {
+      _graphics_frame_buffer_put_pixel(frame_buffer, stride, x, y, bw_fill,
+                                       red_fill);
+    }
 
-  int16_t start = x1;
-  int16_t end = x2;
-  for (uint16_t idx = start; idx < end; idx++) {
-    const int16_t f_idx = slope * (idx - start) + y1;
-    if (f_idx < 0 || f_idx >= frame_buffer->height) {
+    if (x == x2 && y == y2) {
       break;
     }
 
-    graphics_frame_buffer_draw_pixel(frame_buffer, idx, f_idx, color);
+    const int32_t error2 = 2 * error;
+    if (error2 >= dy) {
+      error += dy;
+      x += step_x;
+    }
+    if (error2 <= dx) {
+      error += dx;
+      y += step_y;
+    }
   }
 }
 
@@ -144,30 +730,72 @@ void graphics_frame_buffer_draw_rectangle(graphics_frame_buffer_t *frame_buffer,
                                           uint16_t x, uint16_t y,
                                           uint16_t width, uint16_t height,
                                           graphics_color_e color) {
-  graphics_frame_buffer_draw_line(frame_buffer, x, y, x + width, y, color);
-  graphics_frame_buffer_draw_line(frame_buffer, x, y, x, y + height, color);
-  graphics_frame_buffer_draw_line(frame_buffer, x + width, y, x + width,
-                                  y + height, color);
-  graphics_frame_buffer_draw_line(frame_buffer, x, y + height, x + width,
-                                  y + height, color);
+  if (!width || !height) {
+    return;  // Nothing to draw
+  }
+
+  const uint16_t x2 = ((uint32_t)x + width - 1) < UINT16_MAX
+                          ? (x + width - 1)
+                          : UINT16_MAX;
+  const uint16_t y2 = ((uint32_t)y + height - 1) < UINT16_MAX
+                          ? (y + height - 1)
+                          : UINT16_MAX;
+  _graphics_frame_buffer_mark_dirty(frame_buffer, x, y, x2 + 1, y2 + 1);
+  _graphics_frame_buffer_draw_hline(frame_buffer, x, x2, y, color);
+  _graphics_frame_buffer_draw_hline(frame_buffer, x, x2, y2, color);
+  _graphics_frame_buffer_draw_vline(frame_buffer, x, y, y2, color);
+  _graphics_frame_buffer_draw_vline(frame_buffer, x2, y, y2, color);
 }
 
 void graphics_frame_buffer_fill_rectangle(graphics_frame_buffer_t *frame_buffer,
                                           uint16_t x, uint16_t y,
                                           uint16_t width, uint16_t height,
                                           graphics_color_e color) {
-  for (uint16_t i = 0; i < width; i++) {
-    for (uint16_t j = 0; j < height; j++) {
-      graphics_frame_buffer_draw_pixel(frame_buffer, x + i, y + j, color);
-    }
+  // Clip once, then paint row-major spans.
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  const int32_t x0 = x < clip.x0 ? clip.x0 : x;
+  const int32_t y0 = y < clip.y0 ? clip.y0 : y;
+  const int32_t x1 = ((int32_t)x + width) < clip.x1 ? (x + width) : clip.x1;
+  const int32_t y1 = ((int32_t)y + height) < clip.y1 ? (y + height) : clip.y1;
+  if (x0 >= x1 || y0 >= y1) {
+    return;  // Nothing to draw
+  }
+  _graphics_frame_buffer_mark_dirty(frame_buffer, x0, y0, x1, y1);
+
+  const uint16_t stride = _graphics_frame_buffer_stride(frame_buffer);
+  const uint8_t bw_fill = _color_bw_fill(color);
+  const uint8_t red_fill = _color_red_fill(color);
+
+  for (int32_t row = y0; row < y1; row++) {
+    const uint32_t offset =
+        _graphics_frame_buffer_row_offset(frame_buffer, stride, row);
+    _graphics_frame_buffer_fill_span(&frame_buffer->bw_plane[offset],
+                                     &frame_buffer->red_plane[offset],
+                                     frame_buffer->origin_x + x0,
+                                     frame_buffer->origin_x + x1, bw_fill,
+                                     red_fill);
   }
 }
 
 void dump_graphics_frame_buffer(const graphics_frame_buffer_t *frame_buffer) {
+  const uint16_t stride = _graphics_frame_buffer_stride(frame_buffer);
+
   printf("Dumping graphics frame buffer:\n");
   for (uint16_t y = 0; y < frame_buffer->height; y++) {
     for (uint16_t x = 0; x < frame_buffer->width; x++) {
-      printf("%01X", frame_buffer->buffer[(y * frame_buffer->width) + x]);
+      const uint16_t plane_x = frame_buffer->origin_x + x;
+      const uint32_t byte_index =
+          _graphics_frame_buffer_row_offset(frame_buffer, stride, y) +
+          (plane_x / 8);
+      const uint8_t bit_mask = 0x80 >> (plane_x % 8);
+      graphics_color_e color = GRAPHICS_COLOR_BLACK;
+      if (frame_buffer->red_plane[byte_index] & bit_mask) {
+        color = GRAPHICS_COLOR_RED;
+      } else if (frame_buffer->bw_plane[byte_index] & bit_mask) {
+        color = GRAPHICS_COLOR_WHITE;
+      }
+      printf("%01X", color);
     }
     printf("\n");
     sleep_ms(10);  // Sleep to avoid flooding the console
@@ -195,3 +823,96 @@ void graphics_frame_buffer_draw_bitmap(graphics_frame_buffer_t *frame_buffer,
   _graphics_frame_buffer_draw_bitmap(frame_buffer, x, y, data, width, height,
                                      color, 1);
 }
+
+void graphics_frame_buffer_draw_circle(graphics_frame_buffer_t *frame_buffer,
+                                       uint16_t x, uint16_t y, uint16_t radius,
+                                       graphics_color_e color) {
+  const uint8_t bw_fill = _color_bw_fill(color);
+  const uint8_t red_fill = _color_red_fill(color);
+  const uint16_t stride = _graphics_frame_buffer_stride(frame_buffer);
+
+  // Clip the bounding box once, circles fully inside the clip rectangle are
+  // plotted without per-pixel checks.
+  const graphics_clip_bounds_t clip =
+      _graphics_frame_buffer_clip_bounds(frame_buffer);
+  if ((int32_t)x + radius < clip.x0 || (int32_t)x - radius >= clip.x1 ||
+      (int32_t)y + radius < clip.y0 || (int32_t)y - radius >= clip.y1) {
+    return;  // Out of bounds
+  }
+  _graphics_frame_buffer_mark_dirty(frame_buffer, (int32_t)x - radius,
+                                    (int32_t)y - radius,
+                                    (int32_t)x + radius + 1,
+                                    (int32_t)y + radius + 1);
+  const uint8_t inside =
+      ((int32_t)x - radius >= clip.x0 && (int32_t)x + radius < clip.x1 &&
+       (int32_t)y - radius >= clip.y0 && (int32_t)y + radius < clip.y1);
+
+  // Midpoint circle, every step plots the 8 symmetric octant points.
+  int32_t dx = radius;
+  int32_t dy = 0;
+  int32_t decision = 1 - dx;
+  while (dx >= dy) {
+    const int32_t points[8][2] = {
+        {x + dx, y + dy}, {x - dx, y + dy}, {x + dx, y - dy}, {x - dx, y - dy},
+        {x + dy, y + dx}, {x - dy, y + dx}, {x + dy, y - dx}, {x - dy, y - dx},
+    };
+    for (uint8_t idx = 0; idx < ARRAY_SIZE(points); idx++) {
+      if (inside) {
+        _graphics_frame_buffer_put_pixel(frame_buffer, stride, points[idx][0],
+                                         points[idx][1], bw_fill, red_fill);
+      } else {
+        _graphics_frame_buffer_plot(frame_buffer, &clip, points[idx][0],
+                                    points[idx][1], bw_fill, red_fill);
+      }
+    }
+
+    dy++;
+    if (decision < 0) {
+      decision += 2 * dy + 1;
+    } else {
+      dx--;
+      decision += 2 * (dy - dx) + 1;
+    }
+  }
+}
+
+void graphics_frame_buffer_fill_circle(graphics_frame_buffer_t *frame_buffer,
+                                       uint16_t x, uint16_t y, uint16_t radius,
+                                       graphics_color_e color) {
+  const uint8_t bw_fill = _color_bw_fill(color);
+  const uint8_t red_fill = _color_red_fill(color);
+
+  _graphics_frame_buffer_mark_dirty(frame_buffer, (int32_t)x - radius,
+                                    (int32_t)y - radius,
+                                    (int32_t)x + radius + 1,
+                                    (int32_t)y + radius + 1);
+
+  // Midpoint circle emitting one horizontal span per row, the outer rows
+  // (y +/- dx) are only emitted when dx is about to change.
+  int32_t dx = radius;
+  int32_t dy = 0;
+  int32_t decision = 1 - dx;
+  while (dx >= dy) {
+    _graphics_frame_buffer_fill_hspan(frame_buffer, x - dx, x + dx, y + dy,
+                                      bw_fill, red_fill);
+    if (dy) {
+      _graphics_frame_buffer_fill_hspan(frame_buffer, x - dx, x + dx, y - dy,
+                                        bw_fill, red_fill);
+    }
+
+    if (decision >= 0 && dx != dy) {
+      _graphics_frame_buffer_fill_hspan(frame_buffer, x - dy, x + dy, y + dx,
+                                        bw_fill, red_fill);
+      _graphics_frame_buffer_fill_hspan(frame_buffer, x - dy, x + dy, y - dx,
+                                        bw_fill, red_fill);
+    }
+
+    dy++;
+    if (decision < 0) {
+      decision += 2 * dy + 1;
+    } else {
+      dx--;
+      decision += 2 * (dy - dx) + 1;
+    }
+  }
+}
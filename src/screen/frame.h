@@ -7,24 +7,124 @@
  * It supports drawing pixels, lines, rectangles, and filling shapes with colors.
  *
  * A `graphics_frame_buffer_t` is the key structure that holds the frame buffer data,
- * including its width, height, and a pointer to the pixel data buffer.
+ * including its width, height, and pointers to the pixel data planes.
  *
- * The `graphics_frame_buffer_t#buffer` represents the pixel data in the structure of `ROW_1`,
- * `ROW_2`, ..., `ROW_N`, where each row contains `width` pixels.
+ * The pixel data is stored as two 1bpp planes that match the UC8176 RAM layout, so they can be
+ * sent to the display without any conversion:
+ * - `graphics_frame_buffer_t#bw_plane`: a set bit is a white pixel, a cleared bit is a black pixel.
+ * - `graphics_frame_buffer_t#red_plane`: a set bit is a red pixel (takes precedence over B/W).
+ *
+ * Each plane is structured as `ROW_1`, `ROW_2`, ..., `ROW_N`, where each row contains
+ * `BIT_CAPACITY(width)` bytes, MSB-first (bit 7 of the first byte is the left-most pixel).
+ *
+ * The renderer uploads the planes in place, so they should be allocated in DMA capable memory.
+ *
+ * A frame buffer can also be a view over a window of another frame buffer (See
+ * `graphics_frame_buffer_view`), in that case the planes are shared and the rows of the view are
+ * `graphics_frame_buffer_t#stride` bytes apart, starting at the `origin_x`/`origin_y` pixel.
  */
 #pragma once
 
 #include <utils/defs.h>
 
+/**
+ * @brief Calculates the number of bytes required by a single plane of a frame buffer.
+ *
+ * @param __WIDTH__ The width of the frame buffer in pixels.
+ * @param __HEIGHT__ The height of the frame buffer in pixels.
+ * @return The size in bytes of one plane.
+ */
+#define GRAPHICS_FRAME_BUFFER_PLANE_SIZE(__WIDTH__, __HEIGHT__) (BIT_CAPACITY(__WIDTH__) * (__HEIGHT__))
+
+/**
+ * @brief Maximum number of nested clip rectangles that can be pushed on a frame buffer.
+ */
+#define GRAPHICS_FRAME_BUFFER_CLIP_DEPTH 4
+
+/**
+ * @brief Structure representing a rectangle in frame buffer coordinates.
+ */
+typedef struct {
+  uint16_t x;
+  uint16_t y;
+  uint16_t width;
+  uint16_t height;
+} graphics_rect_t;
+
+/**
+ * @brief Maximum number of dirty rectangles tracked before they are forced to merge.
+ */
+#define GRAPHICS_DIRTY_LIST_SIZE 8
+
+/**
+ * @brief Default area waste, in percent of the merged rectangle, accepted when merging two dirty rectangles.
+ */
+#define GRAPHICS_DIRTY_MERGE_WASTE_PERCENT 30
+
+/**
+ * @brief List of the rectangles touched since the last time it was reset.
+ *
+ * Rectangles are stored in the coordinates of the planes (root frame buffer), so the renderer can use
+ * them directly. When a new rectangle is added it's merged with an existing one if the area of the union
+ * not covered by either of them is at most `merge_waste_percent` of the union. When the list is full the
+ * pair with the least waste is merged regardless of the threshold, so the list is always conservative.
+ */
+typedef struct {
+  graphics_rect_t rects[GRAPHICS_DIRTY_LIST_SIZE];
+  uint8_t count;
+  uint8_t merge_waste_percent;
+} graphics_dirty_list_t;
+
 /**
  * @brief Structure representing a graphics frame buffer.
  *
  * This structure holds the pixel data for a single frame, including its width and height.
+ *
+ * Every drawing primitive is confined to the current clip rectangle, which is the whole frame
+ * unless one was pushed with `graphics_frame_buffer_push_clip`. A zero-initialized clip state is
+ * valid, so the structure can be statically initialized with its planes and dimensions only.
  */
 typedef struct {
-  uint8_t *buffer;
+  /**
+   * @brief Black/White plane, 1bpp MSB-first, a set bit is a white pixel.
+   */
+  uint8_t *bw_plane;
+
+  /**
+   * @brief Red plane, 1bpp MSB-first, a set bit is a red pixel.
+   */
+  uint8_t *red_plane;
+
   uint16_t width;
   uint16_t height;
+
+  /**
+   * @brief Number of bytes between two consecutive rows of the planes, zero means `BIT_CAPACITY(width)`.
+   */
+  uint16_t stride;
+
+  /**
+   * @brief Position of the pixel (0, 0) of this frame buffer inside the planes, non-zero for views.
+   */
+  uint16_t origin_x;
+  uint16_t origin_y;
+
+  /**
+   * @brief Optional list where every primitive reports the area it touched, NULL disables the tracking.
+   *
+   * Views inherit the list of their parent.
+   */
+  graphics_dirty_list_t *dirty;
+
+  /**
+   * @brief Stack of clip rectangles, each entry is already intersected with the previous one.
+   */
+  graphics_rect_t clip_stack[GRAPHICS_FRAME_BUFFER_CLIP_DEPTH];
+
+  /**
+   * @brief Number of clip rectangles pushed, zero means the whole frame is drawable.
+   */
+  uint8_t clip_depth;
 } graphics_frame_buffer_t;
 
 /**
@@ -52,15 +152,110 @@ typedef enum {
 /**
  * @brief Destroys a graphics frame buffer, freeing its allocated memory.
  *
- * This function releases the memory used by the frame buffer's pixel data.
+ * This function releases the memory used by the frame buffer's pixel planes.
  *
  * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to be destroyed.
+ *
+ * @note Views don't own their planes and must not be destroyed.
  */
 void graphics_frame_buffer_destroy(graphics_frame_buffer_t *frame_buffer);
 
+/**
+ * @brief Initializes an empty dirty rectangle list.
+ *
+ * @param dirty_list A pointer to the `graphics_dirty_list_t` structure to initialize.
+ * @param merge_waste_percent Area waste accepted when merging rectangles (See `GRAPHICS_DIRTY_MERGE_WASTE_PERCENT`).
+ */
+void graphics_dirty_list_init(graphics_dirty_list_t *dirty_list, uint8_t merge_waste_percent);
+
+/**
+ * @brief Removes every rectangle from the dirty list.
+ *
+ * @param dirty_list A pointer to the `graphics_dirty_list_t` structure to reset.
+ */
+void graphics_dirty_list_reset(graphics_dirty_list_t *dirty_list);
+
+/**
+ * @brief Adds a rectangle to the dirty list, coalescing it with the existing ones.
+ *
+ * @param dirty_list A pointer to the `graphics_dirty_list_t` structure to update.
+ * @param x The x-coordinate of the top-left corner of the rectangle.
+ * @param y The y-coordinate of the top-left corner of the rectangle.
+ * @param width The width of the rectangle.
+ * @param height The height of the rectangle.
+ */
+void graphics_dirty_list_add(graphics_dirty_list_t *dirty_list, uint16_t x, uint16_t y, uint16_t width,
+                             uint16_t height);
+
+/**
+ * @brief Returns the bounding box of every rectangle in the dirty list.
+ *
+ * @param dirty_list A pointer to the `graphics_dirty_list_t` structure to query.
+ * @return The bounding box, with zero width and height if the list is empty.
+ */
+graphics_rect_t graphics_dirty_list_bounds(const graphics_dirty_list_t *dirty_list);
+
+/**
+ * @brief Creates a view over a window of a frame buffer, without copying any pixel.
+ *
+ * The view shares the parent planes, so everything drawn on it lands in the parent window and the
+ * view coordinates start at the top-left corner of that window. The window is cropped to the parent
+ * size, and the view starts with no clip rectangle pushed.
+ *
+ * @param parent A pointer to the `graphics_frame_buffer_t` (or view) to look into.
+ * @param x The x-coordinate of the top-left corner of the window in the parent.
+ * @param y The y-coordinate of the top-left corner of the window in the parent.
+ * @param width The width of the window.
+ * @param height The height of the window.
+ * @return A `graphics_frame_buffer_t` structure addressing the window.
+ */
+graphics_frame_buffer_t graphics_frame_buffer_view(const graphics_frame_buffer_t *parent, uint16_t x, uint16_t y,
+                                                   uint16_t width, uint16_t height);
+
+/**
+ * @brief Returns the number of bytes between two consecutive rows of the frame buffer planes.
+ *
+ * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to query.
+ * @return The row stride in bytes.
+ */
+uint16_t graphics_frame_buffer_get_stride(const graphics_frame_buffer_t *frame_buffer);
+
+/**
+ * @brief Restricts drawing to the given rectangle until it's popped.
+ *
+ * The rectangle is intersected with the current clip rectangle, so nested widgets can never draw outside
+ * of their parent region.
+ *
+ * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to clip.
+ * @param x The x-coordinate of the top-left corner of the clip rectangle.
+ * @param y The y-coordinate of the top-left corner of the clip rectangle.
+ * @param width The width of the clip rectangle.
+ * @param height The height of the clip rectangle.
+ * @return 1 if the rectangle was pushed, 0 if the clip stack is full (the clip is left untouched).
+ */
+uint8_t graphics_frame_buffer_push_clip(graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y,
+                                        uint16_t width, uint16_t height);
+
+/**
+ * @brief Restores the clip rectangle that was active before the last `graphics_frame_buffer_push_clip`.
+ *
+ * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to unclip.
+ */
+void graphics_frame_buffer_pop_clip(graphics_frame_buffer_t *frame_buffer);
+
+/**
+ * @brief Returns the current clip rectangle of the frame buffer.
+ *
+ * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to query.
+ * @return The rectangle primitives are currently confined to.
+ */
+graphics_rect_t graphics_frame_buffer_get_clip(const graphics_frame_buffer_t *frame_buffer);
+
 /**
  * @brief Clears the frame buffer, filling it with the specified color.
  *
+ * @note The whole frame (or view window) is cleared regardless of the current clip rectangle.
+ *
  * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to be cleared.
  * @param color The color to fill the frame buffer with.
  */
@@ -128,6 +323,24 @@ void graphics_frame_buffer_draw_bitmap(graphics_frame_buffer_t *frame_buffer,
                                       const uint8_t *data, uint16_t width, uint16_t height,
                                       graphics_color_e color);
 
-// TODO: Later implementation
+/**
+ * @brief Draws the outline of a circle on the frame buffer.
+ *
+ * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to draw on.
+ * @param x The x-coordinate of the center of the circle.
+ * @param y The y-coordinate of the center of the circle.
+ * @param radius The radius of the circle in pixels.
+ * @param color The color of the circle to draw.
+ */
 void graphics_frame_buffer_draw_circle(graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y, uint16_t radius, graphics_color_e color);
+
+/**
+ * @brief Fills a circle on the frame buffer with the specified color.
+ *
+ * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to draw on.
+ * @param x The x-coordinate of the center of the circle.
+ * @param y The y-coordinate of the center of the circle.
+ * @param radius The radius of the circle in pixels.
+ * @param color The color to fill the circle with.
+ */
 void graphics_frame_buffer_fill_circle(graphics_frame_buffer_t *frame_buffer, uint16_t x, uint16_t y, uint16_t radius, graphics_color_e color);
@@ -5,9 +5,13 @@
 #include "renderer.h"
 
 #include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/task.h>
 #include <string.h>
 
 #include "drivers/display/waveshare_42in_spi_driver.h"
+#include "utils/ring.h"
 #include "utils/timing.h"
 
 /** Private variables */
@@ -15,37 +19,868 @@
 static const uint16_t internal_width =
     (SCREEN_WIDTH % 8 == 0) ? (SCREEN_WIDTH / 8) : (SCREEN_WIDTH / 8 + 1);
 static const uint16_t internal_height = SCREEN_HEIGHT;
-static uint8_t renderer_buffer[CALC_INTERNAL_HEIGH*CALC_INTERNAL_WIDTH];
+static const char *TAG = "renderer";
 
 static graphics_frame_buffer_t *frame_buffer = NULL;
 
+typedef enum {
+  RENDERER_PLANE_BW,
+  RENDERER_PLANE_RED,
+  RENDERER_PLANE_WHITE,  // Constant white data, not a frame buffer plane
+  RENDERER_PLANE_NONE,
+} renderer_plane_e;
+
+/**
+ * Content tracking of one frame buffer plane.
+ */
+typedef struct {
+  uint32_t tile_hashes[GRAPHICS_RENDERER_TILES];
+  uint8_t blank_tiles[BIT_CAPACITY(GRAPHICS_RENDERER_TILES)];
+
+  // Number of tiles with any bit set, the plane is all zero when 0.
+  uint16_t filled_tiles;
+
+  // Hash of the tile hashes, before and after the last change detection.
+  uint32_t digest;
+  uint32_t previous_digest;
+} renderer_plane_state_t;
+
+/**
+ * What was last written to one of the display RAMs.
+ */
+typedef struct {
+  uint8_t valid;
+  renderer_plane_e source;
+  uint32_t digest;
+  uint8_t blank;
+} renderer_ram_slot_t;
+
+static renderer_plane_state_t plane_states[2];
+static uint8_t changed_tiles[BIT_CAPACITY(GRAPHICS_RENDERER_TILES)];
+static uint8_t tile_hashes_valid = 0;
+
+// Indexed by `_graphics_renderer_slot`, DATA_BW_START and DATA_RED_START.
+static renderer_ram_slot_t ram_slots[2];
+static graphics_renderer_update_mode_e update_mode =
+    GRAPHICS_RENDERER_UPDATE_FULL;
+static ws42_driver_refresh_profile_e refresh_profile =
+    WS42_DRIVER_PROFILE_FULL;
+
+// Whether the display old data RAM (DATA_BW_START) holds the image on the
+// display, as the partial waveform needs.
+static uint8_t old_ram_valid = 0;
+
+// Whether the display RAM still holds the last frame sent, it is lost when
+// the driver RAM epoch changes (deep sleep).
+static uint8_t ram_valid = 0;
+static uint32_t ram_epoch = 0;
+
+// Windows sent by the last partial update, kept until its refresh finishes.
+static graphics_dirty_list_t sent_rects;
+
+#define RENDERER_EVENT_IDLE _BIT(0)
+#define RENDERER_EVENT_BAND_DONE _BIT(1)
+
+typedef enum {
+  RENDERER_REFRESH_NONE,
+  RENDERER_REFRESH_FULL,
+  RENDERER_REFRESH_PARTIAL,
+} renderer_refresh_e;
+
+static EventGroupHandle_t renderer_events = NULL;
+static TaskHandle_t refresh_task = NULL;
+// The callback is written first and `pending_refresh` (a renderer_refresh_e)
+// published last, the renderer task may be reading it from the band loop.
+static atomic_uint pending_refresh;
+static graphics_renderer_done_cb_t done_callback = NULL;
+static void *done_callback_arg = NULL;
+
+// Row bands handed by `graphics_renderer_stream_rows` to the renderer task.
+static graphics_rect_t stream_band_items[GRAPHICS_RENDERER_STREAM_DEPTH];
+static ring_t stream_bands;
+static uint32_t stream_bands_queued = 0;
+static atomic_uint stream_bands_sent;
+static uint8_t stream_active = 0;
+
+// What each display RAM receives from the streamed bands, in the order of
+// DATA_BW_START and DATA_RED_START.
+static renderer_plane_e stream_sources[2];
+
+/**
+ * Rows of a plane packed back to back by `_graphics_renderer_pack_rows`.
+ */
+typedef struct {
+  const uint8_t *first_row;
+  uint16_t stride;
+  uint16_t row_bytes;
+} renderer_rows_t;
+
 /** Private functions */
 
-static void _copy_buffer_to_spi_data(uint8_t *data_buffer, uint16_t width,
-                                     uint16_t height, uint8_t mask) {
-  memset(data_buffer, 0x00, width * height);
+static void _graphics_renderer_pack_rows(uint8_t *chunk, uint32_t offset,
+                                         uint32_t length, void *arg) {
+  const renderer_rows_t *rows = (const renderer_rows_t *)arg;
+  uint32_t row = offset / rows->row_bytes;
+  uint16_t column = offset % rows->row_bytes;
+
+  while (length) {
+    const uint16_t left = rows->row_bytes - column;
+    const uint16_t count = left < length ? left : length;
+    memcpy(chunk, &rows->first_row[(row * rows->stride) + column], count);
+    chunk += count;
+    length -= count;
+    column = 0;
+    row++;
+  }
+}
+
+/**
+ * Sends `height` rows of `row_bytes` starting at `first_row`, packed into the
+ * driver DMA chunks so each row doesn't cost its own SPI transaction.
+ */
+static void _graphics_renderer_send_rows(const uint8_t *first_row,
+                                         uint16_t stride, uint16_t row_bytes,
+                                         uint16_t height) {
+  renderer_rows_t rows = {
+      .first_row = first_row,
+      .stride = stride,
+      .row_bytes = row_bytes,
+  };
+  ws42_driver_send_data_stream(_graphics_renderer_pack_rows, &rows,
+                               (uint32_t)row_bytes * height);
+}
+
+static void _graphics_renderer_fill_white(uint8_t *chunk, uint32_t offset,
+                                         uint32_t length, void *arg) {
+  memset(chunk, 0xFF, length);
+}
+
+static void _graphics_renderer_send_plane(ws42_driver_cmd_e cmd,
+                                         const uint8_t *plane) {
+  // Planes are already stored in the UC8176 RAM layout, so they are sent
+  // straight from the frame buffer memory without any staging copy.
+  const uint16_t stride = graphics_frame_buffer_get_stride(frame_buffer);
+  const uint16_t height = frame_buffer->height < internal_height
+                              ? frame_buffer->height
+                              : internal_height;
+
+  ws42_driver_send_command(cmd);
+  if (plane == NULL) {
+    ws42_driver_send_data_stream(_graphics_renderer_fill_white, NULL,
+                                 internal_width * height);
+    return;
+  }
+
+  const uint8_t *first_row = &plane[(frame_buffer->origin_y * stride) +
+                                    (frame_buffer->origin_x / 8)];
+
+  if (stride == internal_width) {
+    ws42_driver_send_data_buffer(first_row, internal_width * height);
+    return;
+  }
+
+  // Rows of views over a wider frame are not contiguous.
+  _graphics_renderer_send_rows(first_row, stride, internal_width, height);
+}
+
+/**
+ * FNV-1a over the plane bytes covered by the tile, `blank` is set when all of
+ * them are zero.
+ */
+static uint32_t _graphics_renderer_hash_tile(const uint8_t *plane,
+                                             uint16_t tile_x, uint16_t tile_y,
+                                             uint8_t *blank) {
+  const uint16_t stride = graphics_frame_buffer_get_stride(frame_buffer);
+  const uint16_t row_bytes = BIT_CAPACITY(frame_buffer->width);
+  const uint16_t byte_x0 = tile_x * (GRAPHICS_RENDERER_TILE_SIZE / 8);
+  const uint16_t byte_x1 =
+      (byte_x0 + (GRAPHICS_RENDERER_TILE_SIZE / 8)) < row_bytes
+          ? (byte_x0 + (GRAPHICS_RENDERER_TILE_SIZE / 8))
+          : row_bytes;
+  const uint16_t y0 = tile_y * GRAPHICS_RENDERER_TILE_SIZE;
+  const uint16_t y1 = (y0 + GRAPHICS_RENDERER_TILE_SIZE) < frame_buffer->height
+                          ? (y0 + GRAPHICS_RENDERER_TILE_SIZE)
+                          : frame_buffer->height;
+  uint32_t offset = ((frame_buffer->origin_y + y0) * stride) +
+                    (frame_buffer->origin_x / 8);
+  uint32_t hash = 0x811C9DC5;
+  uint8_t bits = 0;
+
+  for (uint16_t row = y0; row < y1; row++, offset += stride) {
+    const uint8_t *plane_row = &plane[offset];
+    for (uint16_t idx = byte_x0; idx < byte_x1; idx++) {
+      hash = (hash ^ plane_row[idx]) * 0x01000193;
+      bits |= plane_row[idx];
+    }
+  }
 
-  for (uint16_t j = 0; j < frame_buffer->height; j++) {
-    for (uint16_t i = 0; i < frame_buffer->width; i++) {
-      uint16_t dst_idx = j * ((frame_buffer->width + 7) / 8) + (i / 8);
-      uint8_t bit_mask = 1 << (7 - (i % 8));  // MSB-first for most displays
+  *blank = !bits;
+  return hash;
+}
 
-      if (frame_buffer->buffer[j * frame_buffer->width + i] & mask) {
-        data_buffer[dst_idx] |= bit_mask;  // Set bit
+/**
+ * Re-hashes one tile of a plane, keeping the blank tiles count up to date.
+ * Returns whether the tile changed.
+ */
+static uint8_t _graphics_renderer_update_tile(renderer_plane_state_t *state,
+                                              const uint8_t *plane,
+                                              uint16_t tile_x, uint16_t tile_y,
+                                              uint16_t tile) {
+  uint8_t blank;
+  const uint32_t hash =
+      _graphics_renderer_hash_tile(plane, tile_x, tile_y, &blank);
+  const uint8_t was_blank = state->blank_tiles[tile / 8] & _BIT(tile % 8);
+
+  if (was_blank && !blank) {
+    state->blank_tiles[tile / 8] &= ~_BIT(tile % 8);
+    state->filled_tiles++;
+  } else if (!was_blank && blank) {
+    state->blank_tiles[tile / 8] |= _BIT(tile % 8);
+    state->filled_tiles--;
+  }
+
+  if (tile_hashes_valid && hash == state->tile_hashes[tile]) {
+    return 0;
+  }
+  state->tile_hashes[tile] = hash;
+  return 1;
+}
+
+static uint32_t _graphics_renderer_plane_digest(
+    const renderer_plane_state_t *state, uint16_t tiles_x, uint16_t tiles_y) {
+  uint32_t digest = 0x811C9DC5;
+  for (uint16_t ty = 0; ty < tiles_y; ty++) {
+    for (uint16_t tx = 0; tx < tiles_x; tx++) {
+      digest = (digest ^ state->tile_hashes[(ty * GRAPHICS_RENDERER_TILES_X) +
+                                            tx]) *
+               0x01000193;
+    }
+  }
+  return digest;
+}
+
+static uint16_t _graphics_renderer_detect_changes(void) {
+  const uint16_t tiles_x =
+      (frame_buffer->width + GRAPHICS_RENDERER_TILE_SIZE - 1) /
+      GRAPHICS_RENDERER_TILE_SIZE;
+  const uint16_t tiles_y =
+      (frame_buffer->height + GRAPHICS_RENDERER_TILE_SIZE - 1) /
+      GRAPHICS_RENDERER_TILE_SIZE;
+  uint8_t candidates[BIT_CAPACITY(GRAPHICS_RENDERER_TILES)];
+  uint16_t changed = 0;
+
+  memset(changed_tiles, 0x00, sizeof(changed_tiles));
+  if (!tile_hashes_valid) {
+    // Every tile is hashed again, start from all blank.
+    for (uint8_t plane = 0; plane < ARRAY_SIZE(plane_states); plane++) {
+      memset(plane_states[plane].blank_tiles, 0xFF,
+             sizeof(plane_states[plane].blank_tiles));
+      plane_states[plane].filled_tiles = 0;
+    }
+  }
+
+  if (!tile_hashes_valid || !frame_buffer->dirty) {
+    memset(candidates, 0xFF, sizeof(candidates));
+  } else {
+    // Dirty rectangles are in plane coordinates, bring them to the frame.
+    memset(candidates, 0x00, sizeof(candidates));
+    for (uint8_t idx = 0; idx < frame_buffer->dirty->count; idx++) {
+      const graphics_rect_t *rect = &frame_buffer->dirty->rects[idx];
+      const int32_t x0 = rect->x - frame_buffer->origin_x;
+      const int32_t y0 = rect->y - frame_buffer->origin_y;
+      const int32_t x1 = x0 + rect->width;
+      const int32_t y1 = y0 + rect->height;
+      if (x1 <= 0 || y1 <= 0 || x0 >= frame_buffer->width ||
+          y0 >= frame_buffer->height) {
+        continue;
+      }
+
+      const uint16_t tx0 = (x0 < 0 ? 0 : x0) / GRAPHICS_RENDERER_TILE_SIZE;
+      const uint16_t ty0 = (y0 < 0 ? 0 : y0) / GRAPHICS_RENDERER_TILE_SIZE;
+      const uint16_t tx1 = (x1 - 1) / GRAPHICS_RENDERER_TILE_SIZE;
+      const uint16_t ty1 = (y1 - 1) / GRAPHICS_RENDERER_TILE_SIZE;
+      for (uint16_t ty = ty0; ty <= ty1 && ty < tiles_y; ty++) {
+        for (uint16_t tx = tx0; tx <= tx1 && tx < tiles_x; tx++) {
+          const uint16_t tile = (ty * GRAPHICS_RENDERER_TILES_X) + tx;
+          candidates[tile / 8] |= _BIT(tile % 8);
+        }
+      }
+    }
+  }
+
+  for (uint16_t ty = 0; ty < tiles_y && ty < GRAPHICS_RENDERER_TILES_Y; ty++) {
+    for (uint16_t tx = 0; tx < tiles_x && tx < GRAPHICS_RENDERER_TILES_X;
+         tx++) {
+      const uint16_t tile = (ty * GRAPHICS_RENDERER_TILES_X) + tx;
+      if (!(candidates[tile / 8] & _BIT(tile % 8))) {
+        continue;
+      }
+
+      const uint8_t bw_changed = _graphics_renderer_update_tile(
+          &plane_states[RENDERER_PLANE_BW], frame_buffer->bw_plane, tx, ty,
+          tile);
+      const uint8_t red_changed = _graphics_renderer_update_tile(
+          &plane_states[RENDERER_PLANE_RED], frame_buffer->red_plane, tx, ty,
+          tile);
+      if (bw_changed || red_changed) {
+        changed_tiles[tile / 8] |= _BIT(tile % 8);
+        changed++;
       }
     }
   }
+
+  for (uint8_t plane = 0; plane < ARRAY_SIZE(plane_states); plane++) {
+    renderer_plane_state_t *state = &plane_states[plane];
+    state->previous_digest = state->digest;
+    state->digest = _graphics_renderer_plane_digest(
+        state,
+        tiles_x < GRAPHICS_RENDERER_TILES_X ? tiles_x
+                                            : GRAPHICS_RENDERER_TILES_X,
+        tiles_y < GRAPHICS_RENDERER_TILES_Y ? tiles_y
+                                            : GRAPHICS_RENDERER_TILES_Y);
+  }
+
+  tile_hashes_valid = 1;
+  return changed;
+}
+
+/**
+ * Widens the rectangle to the controller 8 pixel column granularity.
+ */
+static graphics_rect_t _graphics_renderer_align_rect(graphics_rect_t rect) {
+  const uint16_t max_x = BIT_CAPACITY(frame_buffer->width) * 8;
+  const uint16_t x0 = rect.x & ~0x07;
+  uint16_t x1 = (rect.x + rect.width + 7) & ~0x07;
+  x1 = x1 < max_x ? x1 : max_x;
+
+  rect.x = x0;
+  rect.width = x1 - x0;
+  return rect;
+}
+
+/**
+ * Turns the changed tiles into at most `GRAPHICS_DIRTY_LIST_SIZE` aligned
+ * rectangles, reusing the frame layer coalescing.
+ */
+static void _graphics_renderer_changed_rects(graphics_dirty_list_t *rects) {
+  graphics_dirty_list_init(rects, GRAPHICS_DIRTY_MERGE_WASTE_PERCENT);
+
+  for (uint16_t tile = 0; tile < GRAPHICS_RENDERER_TILES; tile++) {
+    if (!(changed_tiles[tile / 8] & _BIT(tile % 8))) {
+      continue;
+    }
+
+    const uint16_t x = (tile % GRAPHICS_RENDERER_TILES_X) *
+                       GRAPHICS_RENDERER_TILE_SIZE;
+    const uint16_t y = (tile / GRAPHICS_RENDERER_TILES_X) *
+                       GRAPHICS_RENDERER_TILE_SIZE;
+    const uint16_t width = (x + GRAPHICS_RENDERER_TILE_SIZE) < frame_buffer->width
+                               ? GRAPHICS_RENDERER_TILE_SIZE
+                               : (frame_buffer->width - x);
+    const uint16_t height =
+        (y + GRAPHICS_RENDERER_TILE_SIZE) < frame_buffer->height
+            ? GRAPHICS_RENDERER_TILE_SIZE
+            : (frame_buffer->height - y);
+    graphics_dirty_list_add(rects, x, y, width, height);
+  }
+
+  for (uint8_t idx = 0; idx < rects->count; idx++) {
+    rects->rects[idx] = _graphics_renderer_align_rect(rects->rects[idx]);
+  }
+}
+
+/**
+ * Sends the plane bytes under an aligned rectangle, or white when `plane` is
+ * NULL.
+ */
+static void _graphics_renderer_send_plane_window(ws42_driver_cmd_e cmd,
+                                                 const uint8_t *plane,
+                                                 const graphics_rect_t *rect) {
+  const uint16_t stride = graphics_frame_buffer_get_stride(frame_buffer);
+  const uint16_t row_bytes = rect->width / 8;
+
+  ws42_driver_send_command(cmd);
+  if (plane == NULL) {
+    ws42_driver_send_data_stream(_graphics_renderer_fill_white, NULL,
+                                 (uint32_t)row_bytes * rect->height);
+    return;
+  }
+
+  const uint8_t *row = &plane[((frame_buffer->origin_y + rect->y) * stride) +
+                              ((frame_buffer->origin_x + rect->x) / 8)];
+  _graphics_renderer_send_rows(row, stride, row_bytes, rect->height);
+}
+
+static renderer_ram_slot_t *_graphics_renderer_slot(ws42_driver_cmd_e cmd) {
+  return &ram_slots[cmd == WS42_Driver_CMD_DATA_BW_START ? 0 : 1];
+}
+
+static const uint8_t *_graphics_renderer_source_data(renderer_plane_e source) {
+  if (source == RENDERER_PLANE_BW) {
+    return frame_buffer->bw_plane;
+  } else if (source == RENDERER_PLANE_RED) {
+    return frame_buffer->red_plane;
+  }
+  return NULL;  // White
+}
+
+/**
+ * Whether the display RAM read by `cmd` has to be written to hold `source`,
+ * it doesn't when it already holds the same content.
+ */
+static uint8_t _graphics_renderer_slot_needs(ws42_driver_cmd_e cmd,
+                                             renderer_plane_e source) {
+  const renderer_ram_slot_t *slot = _graphics_renderer_slot(cmd);
+  if (source == RENDERER_PLANE_NONE) {
+    return 0;
+  } else if (!slot->valid) {
+    return 1;
+  } else if (source == RENDERER_PLANE_WHITE ||
+             slot->source == RENDERER_PLANE_WHITE) {
+    return source != slot->source;
+  }
+
+  // All zero content is the same whichever plane it came from.
+  const renderer_plane_state_t *state = &plane_states[source];
+  if (slot->blank && !state->filled_tiles) {
+    return 0;
+  }
+  return slot->source != source || slot->digest != state->digest;
+}
+
+/**
+ * Records that `source` was written to the display RAM read by `cmd`, either
+ * whole or only under the changed windows.
+ */
+static void _graphics_renderer_slot_sent(ws42_driver_cmd_e cmd,
+                                         renderer_plane_e source,
+                                         uint8_t whole) {
+  renderer_ram_slot_t *slot = _graphics_renderer_slot(cmd);
+
+  if (!whole) {
+    // Outside of the windows the RAM keeps its content, it only matches the
+    // plane if it held the previous frame of it.
+    if (!slot->valid || source == RENDERER_PLANE_WHITE ||
+        slot->source != source ||
+        slot->digest != plane_states[source].previous_digest) {
+      slot->valid = 0;
+      return;
+    }
+  }
+
+  slot->valid = 1;
+  slot->source = source;
+  if (source == RENDERER_PLANE_WHITE) {
+    slot->digest = 0;
+    slot->blank = 0;
+  } else {
+    slot->digest = plane_states[source].digest;
+    slot->blank = !plane_states[source].filled_tiles;
+  }
 }
 
-static void _copy_buffer_to_spi_data_black_reg(uint8_t *data_buffer,
-                                               uint16_t width,
-                                               uint16_t height) {
-  _copy_buffer_to_spi_data(data_buffer, width, height, 0x01);
+/**
+ * What the active refresh profile reads from each display RAM.
+ */
+static void _graphics_renderer_profile_sources(renderer_plane_e *old_data,
+                                               renderer_plane_e *new_data) {
+  switch (ws42_driver_get_refresh_profile()) {
+    case WS42_DRIVER_PROFILE_FAST_BW:
+      *old_data = RENDERER_PLANE_WHITE;
+      *new_data = RENDERER_PLANE_BW;
+      break;
+    case WS42_DRIVER_PROFILE_PARTIAL:
+      // Already holds the displayed image, synced after the refresh.
+      *old_data = RENDERER_PLANE_NONE;
+      *new_data = RENDERER_PLANE_BW;
+      break;
+    default:
+      *old_data = RENDERER_PLANE_BW;
+      *new_data = RENDERER_PLANE_RED;
+      break;
+  }
 }
 
-static void _copy_buffer_to_spi_data_red_reg(uint8_t *data_buffer,
-                                             uint16_t width, uint16_t height) {
-  _copy_buffer_to_spi_data(data_buffer, width, height, 0x02);
+/**
+ * Sends the planes of the whole frame to the display RAM the active refresh
+ * profile reads, skipping the ones it already holds.
+ */
+static void _graphics_renderer_upload_full(void) {
+  const ws42_driver_cmd_e cmds[] = {WS42_Driver_CMD_DATA_BW_START,
+                                    WS42_Driver_CMD_DATA_RED_START};
+  renderer_plane_e sources[2];
+  _graphics_renderer_profile_sources(&sources[0], &sources[1]);
+
+  for (uint8_t idx = 0; idx < ARRAY_SIZE(cmds); idx++) {
+    if (!_graphics_renderer_slot_needs(cmds[idx], sources[idx])) {
+      continue;
+    }
+    _graphics_renderer_send_plane(cmds[idx],
+                                  _graphics_renderer_source_data(sources[idx]));
+    _graphics_renderer_slot_sent(cmds[idx], sources[idx], 1);
+  }
+}
+
+/**
+ * Uploads each rectangle through its own partial window, then sets the
+ * bounding window of all of them as the one to refresh.
+ */
+static void _graphics_renderer_upload_partial(
+    const graphics_dirty_list_t *rects) {
+  const graphics_rect_t bounds = graphics_dirty_list_bounds(rects);
+  renderer_plane_e old_data, new_data;
+  _graphics_renderer_profile_sources(&old_data, &new_data);
+
+  const uint8_t send_old =
+      _graphics_renderer_slot_needs(WS42_Driver_CMD_DATA_BW_START, old_data);
+  const uint8_t send_new =
+      _graphics_renderer_slot_needs(WS42_Driver_CMD_DATA_RED_START, new_data);
+
+  ws42_driver_partial_enter();
+  for (uint8_t idx = 0; idx < rects->count; idx++) {
+    const graphics_rect_t *rect = &rects->rects[idx];
+    ws42_driver_set_partial_window(rect->x, rect->y, rect->width,
+                                   rect->height);
+    if (send_old) {
+      _graphics_renderer_send_plane_window(
+          WS42_Driver_CMD_DATA_BW_START,
+          _graphics_renderer_source_data(old_data), rect);
+    }
+    if (send_new) {
+      _graphics_renderer_send_plane_window(
+          WS42_Driver_CMD_DATA_RED_START,
+          _graphics_renderer_source_data(new_data), rect);
+    }
+  }
+
+  ws42_driver_set_partial_window(bounds.x, bounds.y, bounds.width,
+                                 bounds.height);
+
+  if (send_old) {
+    _graphics_renderer_slot_sent(WS42_Driver_CMD_DATA_BW_START, old_data, 0);
+  }
+  if (send_new) {
+    _graphics_renderer_slot_sent(WS42_Driver_CMD_DATA_RED_START, new_data, 0);
+  }
+}
+
+/**
+ * Copies the image just refreshed with the partial waveform to the old data
+ * RAM, so the next partial refresh compares against it.
+ */
+static void _graphics_renderer_sync_old_ram(renderer_refresh_e refresh) {
+  if (!_graphics_renderer_slot_needs(WS42_Driver_CMD_DATA_BW_START,
+                                     RENDERER_PLANE_BW)) {
+    return;
+  }
+
+  if (refresh == RENDERER_REFRESH_FULL) {
+    _graphics_renderer_send_plane(WS42_Driver_CMD_DATA_BW_START,
+                                  frame_buffer->bw_plane);
+    _graphics_renderer_slot_sent(WS42_Driver_CMD_DATA_BW_START,
+                                 RENDERER_PLANE_BW, 1);
+    return;
+  }
+
+  for (uint8_t idx = 0; idx < sent_rects.count; idx++) {
+    const graphics_rect_t *rect = &sent_rects.rects[idx];
+    ws42_driver_set_partial_window(rect->x, rect->y, rect->width,
+                                   rect->height);
+    _graphics_renderer_send_plane_window(WS42_Driver_CMD_DATA_BW_START,
+                                         frame_buffer->bw_plane, rect);
+  }
+  _graphics_renderer_slot_sent(WS42_Driver_CMD_DATA_BW_START,
+                               RENDERER_PLANE_BW, 0);
+}
+
+/**
+ * Whether the rows of `plane` under `rect` are all zero.
+ */
+static uint8_t _graphics_renderer_band_blank(const uint8_t *plane,
+                                             const graphics_rect_t *rect) {
+  const uint16_t stride = graphics_frame_buffer_get_stride(frame_buffer);
+  const uint8_t *row = &plane[((frame_buffer->origin_y + rect->y) * stride) +
+                              ((frame_buffer->origin_x + rect->x) / 8)];
+
+  for (uint16_t y = 0; y < rect->height; y++, row += stride) {
+    for (uint16_t idx = 0; idx < rect->width / 8; idx++) {
+      if (row[idx]) {
+        return 0;
+      }
+    }
+  }
+  return 1;
+}
+
+/**
+ * Uploads one band queued by `graphics_renderer_stream_rows` through its own
+ * partial window, runs in the renderer task.
+ */
+static void _graphics_renderer_send_band(const graphics_rect_t *band) {
+  const ws42_driver_cmd_e cmds[] = {WS42_Driver_CMD_DATA_BW_START,
+                                    WS42_Driver_CMD_DATA_RED_START};
+
+  ws42_driver_set_partial_window(band->x, band->y, band->width, band->height);
+  for (uint8_t idx = 0; idx < ARRAY_SIZE(cmds); idx++) {
+    if (stream_sources[idx] == RENDERER_PLANE_NONE) {
+      continue;
+    }
+
+    // A blank band over a blank RAM is already there, e.g. the red plane of
+    // black and white images.
+    const uint8_t *plane = _graphics_renderer_source_data(stream_sources[idx]);
+    const renderer_ram_slot_t *slot = _graphics_renderer_slot(cmds[idx]);
+    if (slot->valid && slot->blank &&
+        _graphics_renderer_band_blank(plane, band)) {
+      continue;
+    }
+    _graphics_renderer_send_plane_window(cmds[idx], plane, band);
+  }
+}
+
+/**
+ * Waits for the renderer task to upload every band queued so far.
+ */
+static void _graphics_renderer_wait_bands(void) {
+  while (atomic_load(&stream_bands_sent) != stream_bands_queued) {
+    xEventGroupWaitBits(renderer_events, RENDERER_EVENT_BAND_DONE, pdTRUE,
+                        pdTRUE, portMAX_DELAY);
+  }
+}
+
+/**
+ * Whether the attached frame buffer can be sent to the display.
+ */
+static uint8_t _graphics_renderer_frame_fits(void) {
+  if (frame_buffer == NULL) {
+    return 0;  // No frame buffer attached
+  }
+
+  if (BIT_CAPACITY(frame_buffer->width) != internal_width ||
+      frame_buffer->origin_x % 8) {
+    ESP_LOGE(TAG,
+             "Frame buffer width %d (origin %d) doesn't match the screen "
+             "width %d",
+             frame_buffer->width, frame_buffer->origin_x, SCREEN_WIDTH);
+    return 0;
+  }
+  return 1;
+}
+
+/**
+ * Picks the refresh profile for the next update from the requested one, the
+ * panel temperature and what the display RAM still holds.
+ */
+static ws42_driver_refresh_profile_e _graphics_renderer_select_profile(void) {
+  if (ws42_driver_get_ram_epoch() != ram_epoch) {
+    ram_epoch = ws42_driver_get_ram_epoch();
+    ram_valid = 0;
+    old_ram_valid = 0;
+    memset(ram_slots, 0x00, sizeof(ram_slots));
+  }
+
+  ws42_driver_refresh_profile_e profile = refresh_profile;
+  if (!ws42_driver_profile_allowed(profile, ws42_driver_get_temperature())) {
+    profile = WS42_DRIVER_PROFILE_FULL;
+  }
+  if (profile == WS42_DRIVER_PROFILE_PARTIAL && !old_ram_valid) {
+    profile = WS42_DRIVER_PROFILE_FAST_BW;
+  }
+  if (profile == WS42_DRIVER_PROFILE_FULL &&
+      ws42_driver_get_refresh_profile() != WS42_DRIVER_PROFILE_FULL) {
+    // The B/W profiles left B/W data in the red RAM, resend everything.
+    graphics_renderer_invalidate();
+  }
+  return profile;
+}
+
+/**
+ * Checks the frame buffer, uploads what changed and starts the display
+ * refresh. Returns the kind of refresh started, it still has to be finished
+ * by `_graphics_renderer_finish_refresh`.
+ */
+static renderer_refresh_e _graphics_renderer_start_refresh(void) {
+  if (frame_buffer == NULL) {
+    return RENDERER_REFRESH_NONE;  // No frame buffer attached
+  }
+
+  const ws42_driver_refresh_profile_e profile =
+      _graphics_renderer_select_profile();
+
+  // Without valid hashes the display content is unknown, always send.
+  if (tile_hashes_valid && frame_buffer->dirty && !frame_buffer->dirty->count) {
+    ESP_LOGI(TAG, "Nothing was drawn since the last update, skipping");
+    return RENDERER_REFRESH_NONE;
+  }
+
+  if (!_graphics_renderer_frame_fits()) {
+    return RENDERER_REFRESH_NONE;
+  }
+
+  // Partial updates need the rest of the panel to hold the previous frame.
+  const uint8_t can_update_partial = tile_hashes_valid && ram_valid &&
+                                     update_mode ==
+                                         GRAPHICS_RENDERER_UPDATE_PARTIAL;
+  const uint16_t changed = _graphics_renderer_detect_changes();
+  if (!changed) {
+    ESP_LOGI(TAG, "Frame is identical to the displayed one, skipping");
+    if (frame_buffer->dirty) {
+      graphics_dirty_list_reset(frame_buffer->dirty);
+    }
+    return RENDERER_REFRESH_NONE;
+  }
+  ESP_LOGI(TAG, "%d tiles changed", changed);
+
+  if (frame_buffer->dirty) {
+    graphics_dirty_list_reset(frame_buffer->dirty);
+  }
+
+  ws42_driver_wake();
+  ws42_driver_set_refresh_profile(profile);
+
+  renderer_refresh_e refresh = RENDERER_REFRESH_FULL;
+  if (can_update_partial) {
+    _graphics_renderer_changed_rects(&sent_rects);
+    if (profile != WS42_DRIVER_PROFILE_FULL) {
+      // The whole refreshed window is read, and outside of the changed rects
+      // the display RAM may still hold tri-color data.
+      sent_rects.rects[0] = graphics_dirty_list_bounds(&sent_rects);
+      sent_rects.count = 1;
+    }
+
+    uint32_t area = 0;
+    for (uint8_t idx = 0; idx < sent_rects.count; idx++) {
+      area +=
+          (uint32_t)sent_rects.rects[idx].width * sent_rects.rects[idx].height;
+    }
+
+    if (area * 100 <= (uint32_t)frame_buffer->width * frame_buffer->height *
+                          GRAPHICS_RENDERER_PARTIAL_MAX_PERCENT) {
+      ESP_LOGI(TAG, "Partial update of %d windows (%u px)", sent_rects.count,
+               (unsigned)area);
+      _graphics_renderer_upload_partial(&sent_rects);
+      refresh = RENDERER_REFRESH_PARTIAL;
+    }
+  }
+
+  if (refresh == RENDERER_REFRESH_FULL) {
+    _graphics_renderer_upload_full();
+  }
+
+  ws42_driver_refresh();
+  return refresh;
+}
+
+/**
+ * Waits for the display to finish the refresh started by
+ * `_graphics_renderer_start_refresh`.
+ */
+static void _graphics_renderer_finish_refresh(renderer_refresh_e refresh) {
+  const ws42_driver_refresh_profile_e profile =
+      ws42_driver_get_refresh_profile();
+
+  ws42_driver_wait_refresh();
+  if (profile == WS42_DRIVER_PROFILE_PARTIAL) {
+    _graphics_renderer_sync_old_ram(refresh);
+  }
+  if (refresh == RENDERER_REFRESH_PARTIAL) {
+    ws42_driver_partial_exit();
+  }
+
+  // The fast B/W waveform leaves white in the old data RAM.
+  old_ram_valid = profile != WS42_DRIVER_PROFILE_FAST_BW;
+  ram_valid = 1;
+
+  ws42_driver_power_down();
+}
+
+/**
+ * Hands a started refresh to the renderer task, or finishes it right away when
+ * the frame buffer is read again afterwards. `callback` is called once it's on
+ * the display.
+ */
+static void _graphics_renderer_dispatch_refresh(
+    renderer_refresh_e refresh, graphics_renderer_done_cb_t callback,
+    void *arg) {
+  if (refresh == RENDERER_REFRESH_NONE ||
+      ws42_driver_get_refresh_profile() == WS42_DRIVER_PROFILE_PARTIAL) {
+    // The partial waveform copies the frame buffer again once refreshed, it
+    // has to be done before the caller draws the next frame.
+    if (refresh != RENDERER_REFRESH_NONE) {
+      _graphics_renderer_finish_refresh(refresh);
+    }
+    xEventGroupSetBits(renderer_events, RENDERER_EVENT_IDLE);
+    if (callback) {
+      callback(arg);
+    }
+    return;
+  }
+
+  xEventGroupClearBits(renderer_events, RENDERER_EVENT_IDLE);
+  done_callback = callback;
+  done_callback_arg = arg;
+  atomic_store_explicit(&pending_refresh, refresh, memory_order_release);
+  xTaskNotifyGive(refresh_task);
+}
+
+/**
+ * Uploads the bands queued by `graphics_renderer_stream_rows` and finishes the
+ * refreshes started by `graphics_renderer_update_async`, then marks the
+ * renderer idle and notifies the caller.
+ */
+static void _graphics_renderer_refresh_task(void *arg) {
+  graphics_rect_t band;
+
+  while (1) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    while (ring_pop(&stream_bands, &band)) {
+      _graphics_renderer_send_band(&band);
+      atomic_fetch_add(&stream_bands_sent, 1);
+      xEventGroupSetBits(renderer_events, RENDERER_EVENT_BAND_DONE);
+    }
+
+    const renderer_refresh_e refresh =
+        (renderer_refresh_e)atomic_load_explicit(&pending_refresh,
+                                                 memory_order_acquire);
+    if (refresh == RENDERER_REFRESH_NONE) {
+      continue;
+    }
+    _graphics_renderer_finish_refresh(refresh);
+    atomic_store_explicit(&pending_refresh, RENDERER_REFRESH_NONE,
+                          memory_order_relaxed);
+
+    const graphics_renderer_done_cb_t callback = done_callback;
+    void *callback_arg = done_callback_arg;
+    xEventGroupSetBits(renderer_events, RENDERER_EVENT_IDLE);
+    if (callback) {
+      callback(callback_arg);
+    }
+    ESP_LOGD(TAG, "Renderer task stack: %u bytes never used",
+             (unsigned)uxTaskGetStackHighWaterMark(NULL));
+  }
+}
+
+static void _graphics_renderer_init_async(void) {
+  if (renderer_events != NULL) {
+    return;
+  }
+
+  renderer_events = xEventGroupCreate();
+  assert(renderer_events != NULL);
+  xEventGroupSetBits(renderer_events, RENDERER_EVENT_IDLE);
+  ring_init(&stream_bands, stream_band_items, sizeof(graphics_rect_t),
+            GRAPHICS_RENDERER_STREAM_DEPTH);
+  atomic_init(&stream_bands_sent, 0);
+  atomic_init(&pending_refresh, RENDERER_REFRESH_NONE);
+
+  // The display transfers and BUSY waits run on their own core, while the
+  // caller keeps loading the next rows.
+  const BaseType_t created = xTaskCreatePinnedToCore(
+      _graphics_renderer_refresh_task, "renderer",
+      GRAPHICS_RENDERER_TASK_STACK_SIZE, NULL, GRAPHICS_RENDERER_TASK_PRIORITY,
+      &refresh_task, GRAPHICS_RENDERER_TASK_CORE);
+  assert(created == pdPASS);
 }
 
 void _dump_graphics_frame_buffer(uint8_t *data_buffer, uint16_t width,
@@ -64,32 +899,189 @@ void _dump_graphics_frame_buffer(uint8_t *data_buffer, uint16_t width,
 /** Public functions */
 
 void graphics_renderer_attach(graphics_frame_buffer_t *fb) {
+  _graphics_renderer_init_async();
+  graphics_renderer_wait(portMAX_DELAY);
   frame_buffer = fb;
+  graphics_renderer_invalidate();
 }
 
 void graphics_renderer_detach(void) {
+  graphics_renderer_wait(portMAX_DELAY);
   frame_buffer = NULL;
 }
 
+void graphics_renderer_set_update_mode(graphics_renderer_update_mode_e mode) {
+  update_mode = mode;
+}
+
+void graphics_renderer_set_refresh_profile(
+    ws42_driver_refresh_profile_e profile) {
+  refresh_profile = profile;
+}
+
+void graphics_renderer_invalidate(void) {
+  tile_hashes_valid = 0;
+  old_ram_valid = 0;
+  memset(ram_slots, 0x00, sizeof(ram_slots));
+}
+
 void graphics_renderer_update(void) {
-  if (frame_buffer == NULL) {
-    return;  // No frame buffer attached
+  graphics_renderer_wait(portMAX_DELAY);
+
+  const renderer_refresh_e refresh = _graphics_renderer_start_refresh();
+  if (refresh != RENDERER_REFRESH_NONE) {
+    _graphics_renderer_finish_refresh(refresh);
   }
+}
 
-  _copy_buffer_to_spi_data_black_reg(renderer_buffer, internal_width,
-                                     internal_height);
-  ws42_driver_send_command(WS42_Driver_CMD_DATA_BW_START);
-  ws42_driver_send_data_buffer(renderer_buffer,
-                               internal_width * internal_height);
+void graphics_renderer_update_async(graphics_renderer_done_cb_t callback,
+                                    void *arg) {
+  _graphics_renderer_init_async();
+  graphics_renderer_wait(portMAX_DELAY);
 
-  _copy_buffer_to_spi_data_red_reg(renderer_buffer, internal_width,
-                                   internal_height);
-  ws42_driver_send_command(WS42_Driver_CMD_DATA_RED_START);
-  ws42_driver_send_data_buffer(renderer_buffer,
-                               internal_width * internal_height);
+  _graphics_renderer_dispatch_refresh(_graphics_renderer_start_refresh(),
+                                      callback, arg);
+}
+
+uint8_t graphics_renderer_stream_begin(void) {
+  const ws42_driver_cmd_e cmds[] = {WS42_Driver_CMD_DATA_BW_START,
+                                    WS42_Driver_CMD_DATA_RED_START};
+
+  _graphics_renderer_init_async();
+  graphics_renderer_wait(portMAX_DELAY);
+  if (!_graphics_renderer_frame_fits()) {
+    return ESP_FAIL;
+  }
+
+  const ws42_driver_refresh_profile_e profile =
+      _graphics_renderer_select_profile();
+  xEventGroupClearBits(renderer_events, RENDERER_EVENT_IDLE);
+  ws42_driver_wake();
+  ws42_driver_set_refresh_profile(profile);
+
+  // Constant white RAMs are written up front, the planes follow band by band.
+  _graphics_renderer_profile_sources(&stream_sources[0], &stream_sources[1]);
+  for (uint8_t idx = 0; idx < ARRAY_SIZE(cmds); idx++) {
+    if (stream_sources[idx] != RENDERER_PLANE_WHITE) {
+      continue;
+    }
+    if (_graphics_renderer_slot_needs(cmds[idx], RENDERER_PLANE_WHITE)) {
+      _graphics_renderer_send_plane(cmds[idx], NULL);
+      _graphics_renderer_slot_sent(cmds[idx], RENDERER_PLANE_WHITE, 1);
+    }
+    stream_sources[idx] = RENDERER_PLANE_NONE;
+  }
+
+  ws42_driver_partial_enter();
+  stream_bands_queued = 0;
+  atomic_store(&stream_bands_sent, 0);
+  stream_active = 1;
+  return ESP_OK;
+}
+
+void graphics_renderer_stream_rows(uint16_t y, uint16_t height) {
+  if (!stream_active) {
+    return;
+  }
+
+  const uint16_t rows =
+      frame_buffer->height < internal_height ? frame_buffer->height
+                                             : internal_height;
+  if (y >= rows || !height) {
+    return;
+  }
+
+  const graphics_rect_t band = {
+      .x = 0,
+      .y = y,
+      .width = internal_width * 8,
+      .height = (y + height) < rows ? height : (rows - y),
+  };
+  if (frame_buffer->dirty) {
+    graphics_dirty_list_add(frame_buffer->dirty, frame_buffer->origin_x,
+                            frame_buffer->origin_y + band.y,
+                            frame_buffer->width, band.height);
+  }
+
+  while (!ring_push(&stream_bands, &band)) {
+    // Full, let the renderer task catch up.
+    xTaskNotifyGive(refresh_task);
+    xEventGroupWaitBits(renderer_events, RENDERER_EVENT_BAND_DONE, pdTRUE,
+                        pdTRUE, portMAX_DELAY);
+  }
+  stream_bands_queued++;
+  xTaskNotifyGive(refresh_task);
+}
+
+void graphics_renderer_stream_end(graphics_renderer_done_cb_t callback,
+                                  void *arg) {
+  const ws42_driver_cmd_e cmds[] = {WS42_Driver_CMD_DATA_BW_START,
+                                    WS42_Driver_CMD_DATA_RED_START};
+
+  if (!stream_active) {
+    return;
+  }
+  _graphics_renderer_wait_bands();
+  stream_active = 0;
+  ws42_driver_partial_exit();
+
+  // The bands covered the whole frame, the display RAMs now hold the planes.
+  const uint16_t changed = _graphics_renderer_detect_changes();
+  if (frame_buffer->dirty) {
+    graphics_dirty_list_reset(frame_buffer->dirty);
+  }
+  for (uint8_t idx = 0; idx < ARRAY_SIZE(cmds); idx++) {
+    if (stream_sources[idx] != RENDERER_PLANE_NONE) {
+      _graphics_renderer_slot_sent(cmds[idx], stream_sources[idx], 1);
+    }
+  }
+
+  renderer_refresh_e refresh = RENDERER_REFRESH_NONE;
+  if (changed || !ram_valid) {
+    ESP_LOGI(TAG, "Streamed frame, %d tiles changed", changed);
+    ws42_driver_refresh();
+    refresh = RENDERER_REFRESH_FULL;
+  } else {
+    ESP_LOGI(TAG, "Frame is identical to the displayed one, skipping");
+    ws42_driver_power_down();
+  }
+  _graphics_renderer_dispatch_refresh(refresh, callback, arg);
+}
+
+void graphics_renderer_stream_cancel(void) {
+  if (!stream_active) {
+    return;
+  }
+  _graphics_renderer_wait_bands();
+  stream_active = 0;
+  ws42_driver_partial_exit();
+
+  // The display keeps showing the previous image but its RAM now holds part
+  // of the cancelled one, nothing sent so far can be trusted.
+  ram_valid = 0;
+  graphics_renderer_invalidate();
+  if (frame_buffer->dirty) {
+    graphics_dirty_list_reset(frame_buffer->dirty);
+  }
+  ws42_driver_power_down();
+  _graphics_renderer_dispatch_refresh(RENDERER_REFRESH_NONE, NULL, NULL);
+}
+
+uint8_t graphics_renderer_is_refreshing(void) {
+  if (renderer_events == NULL) {
+    return 0;
+  }
+  return (xEventGroupGetBits(renderer_events) & RENDERER_EVENT_IDLE) ? 0 : 1;
+}
+
+uint8_t graphics_renderer_wait(uint32_t timeout_ms) {
+  if (renderer_events == NULL) {
+    return 1;
+  }
 
-  ws42_driver_send_command(WS42_Driver_CMD_DISPLAY_REFRESH);
-  sleep_ms(200);
-  ws42_driver_wait_busy_ack();
-  sleep_ms(2000);
+  const TickType_t ticks =
+      timeout_ms == portMAX_DELAY ? portMAX_DELAY : pdMS_TO_TICKS(timeout_ms);
+  const EventBits_t bits = xEventGroupWaitBits(
+      renderer_events, RENDERER_EVENT_IDLE, pdFALSE, pdTRUE, ticks);
+  return (bits & RENDERER_EVENT_IDLE) ? 1 : 0;
 }
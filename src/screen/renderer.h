@@ -5,6 +5,7 @@
  */
 #pragma once
 
+#include "drivers/display/waveshare_42in_spi_driver.h"
 #include "frame.h"
 
 #define CALC_INTERNAL_WIDTH ((SCREEN_WIDTH % 8 == 0) ? (SCREEN_WIDTH / 8) : (SCREEN_WIDTH / 8 + 1))
@@ -13,10 +14,74 @@
 #define SCREEN_HEIGHT 300
 #define SCREEN_WIDTH 400
 
+/**
+ * @brief Size in pixels of the square tiles used to detect changes between two updates.
+ *
+ * Must be a multiple of 8 so a tile row is made of whole plane bytes.
+ */
+#define GRAPHICS_RENDERER_TILE_SIZE 16
+#define GRAPHICS_RENDERER_TILES_X ((SCREEN_WIDTH + GRAPHICS_RENDERER_TILE_SIZE - 1) / GRAPHICS_RENDERER_TILE_SIZE)
+#define GRAPHICS_RENDERER_TILES_Y ((SCREEN_HEIGHT + GRAPHICS_RENDERER_TILE_SIZE - 1) / GRAPHICS_RENDERER_TILE_SIZE)
+#define GRAPHICS_RENDERER_TILES (GRAPHICS_RENDERER_TILES_X * GRAPHICS_RENDERER_TILES_Y)
+
+/**
+ * @brief Largest changed area, in percent of the screen, that is still sent as a partial update.
+ */
+#define GRAPHICS_RENDERER_PARTIAL_MAX_PERCENT 50
+
+/**
+ * @brief Stack size and priority of the task that waits for the asynchronous refreshes to finish.
+ *
+ * The task uploads bands, logs and runs the completion callbacks (See `graphics_renderer_done_cb_t`), the bytes it
+ * never used are logged at debug level after every refresh.
+ */
+#define GRAPHICS_RENDERER_TASK_STACK_SIZE 4096
+#define GRAPHICS_RENDERER_TASK_PRIORITY 5
+
+/**
+ * @brief Core the renderer task is pinned to, the display transfers and BUSY waits run there.
+ */
+#define GRAPHICS_RENDERER_TASK_CORE 1
+
+/**
+ * @brief Number of row bands `graphics_renderer_stream_rows` can queue ahead of the upload, a power of two.
+ */
+#define GRAPHICS_RENDERER_STREAM_DEPTH 4
+
+/**
+ * @brief Called once an update started by `graphics_renderer_update_async` is on the display.
+ *
+ * @note Runs in the renderer task, or in the caller when there was nothing to refresh. The renderer task stack
+ * is `GRAPHICS_RENDERER_TASK_STACK_SIZE`, keep the callback short and hand heavier work to another task.
+ */
+typedef void (*graphics_renderer_done_cb_t)(void *arg);
+
+/**
+ * @brief How the renderer pushes a frame to the display.
+ */
+typedef enum {
+  /**
+   * @brief Both planes are sent whole and the full panel is refreshed.
+   */
+  GRAPHICS_RENDERER_UPDATE_FULL,
+
+  /**
+   * @brief Only the changed regions are sent through the controller partial windows and refreshed, falls back
+   * to a full update for the first frame or when more than `GRAPHICS_RENDERER_PARTIAL_MAX_PERCENT` changed.
+   */
+  GRAPHICS_RENDERER_UPDATE_PARTIAL,
+} graphics_renderer_update_mode_e;
+
 /**
  * @brief Attaches a graphics frame buffer to the renderer.
  *
  * This function sets the specified frame buffer as the target for rendering operations.
+ * Views (See `graphics_frame_buffer_view`) are accepted too, their rows are read in place.
+ *
+ * @note The frame buffer is always shown from the top-left corner of the panel, so it must be `SCREEN_WIDTH`
+ * pixels wide and a view must start on a byte (`origin_x` a multiple of 8), e.g. a window scrolled over a
+ * larger canvas. Narrower frame buffers and views are rejected by the updates, draw them into a full width
+ * view instead.
  *
  * @param frame_buffer A pointer to the `graphics_frame_buffer_t` structure to attach.
  */
@@ -33,5 +98,118 @@ void graphics_renderer_detach(void);
  * @brief Updates the display with the contents of the attached frame buffer.
  *
  * This function renders the current frame buffer to the display.
+ *
+ * When the frame buffer has a dirty list (See `graphics_frame_buffer_t#dirty`), the update is skipped if
+ * nothing was drawn since the previous one, and the list is reset once the planes are uploaded.
+ *
+ * The renderer also keeps a hash of every `GRAPHICS_RENDERER_TILE_SIZE` tile of the last frame it sent,
+ * only the tiles under the dirty list (or all of them without one) are hashed again, and if none of them
+ * changed the SPI transfer and the display refresh are skipped entirely.
+ *
+ * The hashes are kept per plane, a plane whose content the display RAM already holds (or that is blank on both
+ * sides) is not sent again, e.g. the red plane of a black and white slideshow is only cleared once.
  */
 void graphics_renderer_update(void);
+
+/**
+ * @brief Same as `graphics_renderer_update`, but returns as soon as the planes are uploaded and the display
+ * refresh is started, instead of blocking for the whole refresh.
+ *
+ * The frame buffer can be drawn again right away, the display keeps its own copy of the planes. A refresh still
+ * in progress is waited for before uploading, as is done by every other renderer call.
+ *
+ * With `WS42_DRIVER_PROFILE_PARTIAL` the frame buffer is read again after the refresh, so this behaves as
+ * `graphics_renderer_update` followed by the callback.
+ *
+ * @param callback Called once the display finished refreshing, can be NULL (See `graphics_renderer_done_cb_t`).
+ * @param arg Argument passed to the callback.
+ */
+void graphics_renderer_update_async(graphics_renderer_done_cb_t callback, void *arg);
+
+/**
+ * @brief Starts streaming a whole frame to the display, the rows are uploaded as soon as they are ready
+ * instead of once the frame is complete.
+ *
+ * Once started, the caller writes the planes of the attached frame buffer top to bottom and hands every band
+ * of finished rows to `graphics_renderer_stream_rows`. The renderer task (on `GRAPHICS_RENDERER_TASK_CORE`)
+ * uploads the bands while the caller loads the next ones, then `graphics_renderer_stream_end` refreshes the
+ * panel like `graphics_renderer_update_async` does.
+ *
+ * @note Rows handed over must not be written again until `graphics_renderer_stream_end` (or
+ * `graphics_renderer_stream_cancel`) returns, and no other renderer call may be made meanwhile.
+ *
+ * @return uint8_t ESP_OK when streaming started, ESP_FAIL if the frame buffer doesn't fit the display.
+ */
+uint8_t graphics_renderer_stream_begin(void);
+
+/**
+ * @brief Queues rows of the frame buffer for upload, waits when `GRAPHICS_RENDERER_STREAM_DEPTH` bands are
+ * already queued.
+ *
+ * @param y First row of the band, bands must be handed in order and cover the whole frame.
+ * @param height Number of rows in the band.
+ */
+void graphics_renderer_stream_rows(uint16_t y, uint16_t height);
+
+/**
+ * @brief Waits for the queued bands to be uploaded and starts the display refresh.
+ *
+ * The frame buffer can be drawn again once this returns. If the frame turned out identical to the one on
+ * the display the refresh is skipped.
+ *
+ * @param callback Called once the display finished refreshing, can be NULL (See `graphics_renderer_done_cb_t`).
+ * @param arg Argument passed to the callback.
+ */
+void graphics_renderer_stream_end(graphics_renderer_done_cb_t callback, void *arg);
+
+/**
+ * @brief Waits for the queued bands to be uploaded and stops streaming without refreshing, for frames that
+ * turned out broken halfway.
+ *
+ * The display keeps showing the previous image, the next update resends the whole frame.
+ */
+void graphics_renderer_stream_cancel(void);
+
+/**
+ * @brief Checks whether a refresh started by `graphics_renderer_update_async` is still in progress.
+ *
+ * @return uint8_t 1 while the display is refreshing, 0 otherwise.
+ */
+uint8_t graphics_renderer_is_refreshing(void);
+
+/**
+ * @brief Waits for a refresh started by `graphics_renderer_update_async` to finish.
+ *
+ * @param timeout_ms Longest time to wait in milliseconds, `portMAX_DELAY` to wait forever.
+ * @return uint8_t 1 when the renderer is idle, 0 when the timeout expired first.
+ */
+uint8_t graphics_renderer_wait(uint32_t timeout_ms);
+
+/**
+ * @brief Selects how the next updates are pushed to the display, `GRAPHICS_RENDERER_UPDATE_FULL` by default.
+ *
+ * @param mode The update mode to use.
+ */
+void graphics_renderer_set_update_mode(graphics_renderer_update_mode_e mode);
+
+/**
+ * @brief Selects the display waveform for the next updates, `WS42_DRIVER_PROFILE_FULL` by default.
+ *
+ * Profiles not suited to the panel temperature (See `ws42_driver_profile_allowed`) are replaced by
+ * `WS42_DRIVER_PROFILE_FULL`.
+ *
+ * The B/W profiles only show the B/W plane. `WS42_DRIVER_PROFILE_PARTIAL` needs the display to hold a known image,
+ * the first update
+ * after an invalidation or a `WS42_DRIVER_PROFILE_FAST_BW` one uses `WS42_DRIVER_PROFILE_FAST_BW` instead. Going back to
+ * `WS42_DRIVER_PROFILE_FULL` always resends both planes.
+ *
+ * @param profile The refresh profile to use (See `ws42_driver_refresh_profile_e`).
+ */
+void graphics_renderer_set_refresh_profile(ws42_driver_refresh_profile_e profile);
+
+/**
+ * @brief Forgets the tile hashes of the last frame sent, so the next update always reaches the display.
+ *
+ * Should be called whenever the display content is lost or changed behind the renderer back.
+ */
+void graphics_renderer_invalidate(void);
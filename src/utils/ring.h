@@ -0,0 +1,95 @@
+/**
+ * @file ring.h
+ * @author jdanypa@gmail.com (Elemeants)
+ * @brief Bounded single producer, single consumer ring
+ *
+ * This header file provides a lock-free ring of fixed size items, meant to hand work from one task to
+ * another (possibly running on the other core) without taking a lock on every item.
+ *
+ * Only one task may push and only one task may pop, the ring doesn't block, callers wait for room or
+ * items with their own means (e.g. task notifications or event groups).
+ */
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @brief Ring state, the storage is provided by the owner (See `ring_init`).
+ */
+typedef struct {
+  uint8_t *items;
+  uint16_t item_size;
+
+  /**
+   * @brief Number of items the storage holds, must be a power of two.
+   */
+  uint16_t capacity;
+
+  /**
+   * @brief Free running counters, `head` is only written by the producer and `tail` only by the consumer.
+   */
+  atomic_uint head;
+  atomic_uint tail;
+} ring_t;
+
+/**
+ * @brief Initializes an empty ring over `storage`.
+ *
+ * @param ring Ring to initialize.
+ * @param storage Buffer of `capacity * item_size` bytes.
+ * @param item_size Size in bytes of each item.
+ * @param capacity Number of items, must be a power of two.
+ */
+static inline void ring_init(ring_t *ring, void *storage, uint16_t item_size, uint16_t capacity) {
+  ring->items = (uint8_t *)storage;
+  ring->item_size = item_size;
+  ring->capacity = capacity;
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+}
+
+/**
+ * @brief Copies `item` into the ring, only to be called by the producer.
+ *
+ * @return uint8_t 1 when the item was queued, 0 when the ring is full.
+ */
+static inline uint8_t ring_push(ring_t *ring, const void *item) {
+  const unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  const unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  if (head - tail >= ring->capacity) {
+    return 0;
+  }
+
+  memcpy(&ring->items[(head & (ring->capacity - 1)) * ring->item_size], item, ring->item_size);
+  // Publish the item before the new head.
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return 1;
+}
+
+/**
+ * @brief Copies the oldest item of the ring into `item`, only to be called by the consumer.
+ *
+ * @return uint8_t 1 when an item was taken, 0 when the ring is empty.
+ */
+static inline uint8_t ring_pop(ring_t *ring, void *item) {
+  const unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  const unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+  if (head == tail) {
+    return 0;
+  }
+
+  memcpy(item, &ring->items[(tail & (ring->capacity - 1)) * ring->item_size], ring->item_size);
+  // Release the slot only once it was read.
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+/**
+ * @brief Number of items queued, exact from either side for its own end.
+ */
+static inline uint16_t ring_count(ring_t *ring) {
+  return atomic_load_explicit(&ring->head, memory_order_acquire) -
+         atomic_load_explicit(&ring->tail, memory_order_acquire);
+}